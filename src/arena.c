@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE ((size_t) 4 << 20)
+#define ARENA_ALIGN 16
+
+struct _chunk {
+    struct _chunk *prev;
+    size_t size;
+    size_t used;
+
+    // keeps data aligned to ARENA_ALIGN
+    union {
+        long double ld;
+        uint64_t u;
+        void *p;
+    } data[];
+};
+
+struct arena {
+    pthread_mutex_t lock;
+    struct _chunk *head; // chunk being filled, NULL before the first allocation
+    size_t used;
+};
+
+struct arena *arena_new(void) {
+    struct arena *arena = malloc(sizeof(struct arena));
+    if (!arena) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->head = NULL;
+    arena->used = 0;
+    return arena;
+}
+
+void arena_free(struct arena *arena) {
+    if (!arena) {
+        return;
+    }
+
+    struct _chunk *chunk = arena->head;
+    while (chunk) {
+        struct _chunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    pthread_mutex_lock(&arena->lock);
+    struct _chunk *chunk = arena->head;
+    if (!chunk || chunk->size - chunk->used < size) {
+
+        // the rest of the current chunk is abandoned
+        const size_t chunk_size = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(struct _chunk) + chunk_size);
+        if (!chunk) {
+            pthread_mutex_unlock(&arena->lock);
+            return NULL;
+        }
+
+        chunk->prev = arena->head;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        arena->head = chunk;
+    }
+
+    void *ptr = (uint8_t*) chunk->data + chunk->used;
+    chunk->used += size;
+    arena->used += size;
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+size_t arena_used(const struct arena *arena) {
+    return arena->used;
+}
@@ -0,0 +1,27 @@
+#ifndef KERPLUNK_ARENA_H_
+#define KERPLUNK_ARENA_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// region allocator
+//
+// Memory is carved sequentially out of large chunks and can only be
+// released all at once, by freeing the arena. Allocations are aligned for
+// any object type. Allocating is thread safe; each arena has its own lock.
+//
+
+struct arena;
+
+struct arena *arena_new(void);
+void arena_free(struct arena *arena);
+
+// Returns NULL on allocation failure.
+void *arena_alloc(struct arena *arena, size_t size);
+
+// bytes handed out so far
+size_t arena_used(const struct arena *arena);
+
+#endif//KERPLUNK_ARENA_H_
@@ -0,0 +1,538 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "batch.h"
+
+// position flags
+
+#define EMPTY GO_COLOR_EMPTY
+#define BLACK GO_COLOR_BLACK
+#define WHITE GO_COLOR_WHITE
+
+// bit layout, shared with struct go_bitboard
+
+#define BB_WIDTH(size) ((size) + 1)
+#define BB_BIT(size, row, col) (((row) - 1) * BB_WIDTH(size) + ((col) - 1))
+
+typedef uint64_t (*_board)[GO_BATCH_MAX];
+
+static const uint64_t _zero[GO_BATCH_MAX];
+
+//
+// lane-parallel bitboard algebra
+//
+// The helpers work on one word of one lane, given the same lane's words
+// before and after it. Lane loops built from them do the same branch-free
+// operations on consecutive memory, so they are vectorized.
+//
+
+// word moved shift bits up (toward the next row) or down, carrying across
+// words
+static inline uint64_t _up(uint64_t word, uint64_t prev, size_t shift) {
+    return (word << shift) | (prev >> (64 - shift));
+}
+
+static inline uint64_t _down(uint64_t word, uint64_t next, size_t shift) {
+    return (word >> shift) | (next << (64 - shift));
+}
+
+// points with a set neighbor; the guard bit of each row keeps the left
+// and right neighbors from wrapping
+static inline uint64_t _adjacent(uint64_t word, uint64_t prev, uint64_t next, size_t width) {
+    return _up(word, prev, 1) | _down(word, next, 1) |
+        _up(word, prev, width) | _down(word, next, width);
+}
+
+// points set in at least two of four boards
+static inline uint64_t _two(uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+    return (a & b) | (c & d) | ((a | b) & (c | d));
+}
+
+// Works out which points of every lane are candidates for the side to
+// move (empty and not its eye, by the rule of go_playout_move) and which
+// of those are safe (a stone there has a liberty and captures nothing).
+static void _candidates(struct go_batch *batch, _board candidates, _board safe) {
+    const size_t words = batch->words;
+    const size_t count = batch->count;
+    const size_t width = BB_WIDTH(batch->size);
+
+    _board empty = batch->empty;
+    _board opp = (batch->turn == BLACK) ? batch->white : batch->black;
+
+    // opposing stones with fewer than two empty neighbors, which a stone
+    // next to them might capture, and points with an empty neighbor
+    go_batch_board short_libs;
+    for (size_t i = 0; i < words; i++) {
+        const uint64_t *ep = i ? empty[i-1] : _zero;
+        const uint64_t *en = (i + 1 < words) ? empty[i+1] : _zero;
+
+        for (size_t l = 0; l < count; l++) {
+            const uint64_t e = empty[i][l];
+            const uint64_t west = _up(e, ep[l], 1);
+            const uint64_t east = _down(e, en[l], 1);
+            const uint64_t north = _up(e, ep[l], width);
+            const uint64_t south = _down(e, en[l], width);
+
+            short_libs[i][l] = opp[i][l] & ~_two(west, east, north, south);
+            safe[i][l] = west | east | north | south;
+        }
+    }
+
+    for (size_t i = 0; i < words; i++) {
+        const uint64_t *ep = i ? empty[i-1] : _zero;
+        const uint64_t *en = (i + 1 < words) ? empty[i+1] : _zero;
+        const uint64_t *op = i ? opp[i-1] : _zero;
+        const uint64_t *on = (i + 1 < words) ? opp[i+1] : _zero;
+        const uint64_t *sp = i ? short_libs[i-1] : _zero;
+        const uint64_t *sn = (i + 1 < words) ? short_libs[i+1] : _zero;
+        const uint64_t edge = batch->edge[i];
+
+        for (size_t l = 0; l < count; l++) {
+            const uint64_t e = empty[i][l];
+            const uint64_t o = opp[i][l];
+
+            // eyes: no neighbor is empty or the opponent's, and the
+            // opponent holds fewer than two diagonals, or none on the edge
+            const uint64_t open = _adjacent(e | o, ep[l] | op[l], en[l] | on[l], width);
+            const uint64_t a = _up(o, op[l], width - 1);
+            const uint64_t b = _up(o, op[l], width + 1);
+            const uint64_t c = _down(o, on[l], width - 1);
+            const uint64_t d = _down(o, on[l], width + 1);
+            const uint64_t eyes = e & ~open & ~_two(a, b, c, d) & ~((a | b | c | d) & edge);
+
+            const uint64_t threatened = _adjacent(short_libs[i][l], sp[l], sn[l], width);
+
+            candidates[i][l] = e & ~eyes;
+            safe[i][l] &= candidates[i][l] & ~threatened;
+        }
+    }
+}
+
+// Grows region through connected points of mask in every lane at once,
+// until no lane changes.
+static void _flood(struct go_batch *batch, _board region, _board mask) {
+    const size_t words = batch->words;
+    const size_t count = batch->count;
+    const size_t width = BB_WIDTH(batch->size);
+
+    while (1) {
+        uint64_t changed = 0;
+        for (size_t i = 0; i < words; i++) {
+            const uint64_t *prev = i ? region[i-1] : _zero;
+            const uint64_t *next = (i + 1 < words) ? region[i+1] : _zero;
+
+            for (size_t l = 0; l < count; l++) {
+                const uint64_t r = region[i][l];
+                const uint64_t m = mask[i][l];
+                uint64_t grown = (r | _adjacent(r, prev[l], next[l], width)) & m;
+
+                // adding the region to the mask carries each region bit up
+                // through its run of mask bits, which fills whole row
+                // segments toward higher bits in one step
+                grown |= ((m + grown) ^ m) & m;
+
+                changed |= grown ^ r;
+                region[i][l] = grown;
+            }
+        }
+
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+//
+// per-lane move checks
+//
+// The same checks as go_bitstate makes, on one lane of the batch.
+//
+
+static inline bool _test(_board board, size_t lane, size_t bit) {
+    return (board[bit / 64][lane] >> (bit % 64)) & 1;
+}
+
+// The bits of the orthogonal neighbors of a point. Neighbors past the left
+// or right edge are guard bits, which are never set in any board.
+static inline size_t _neighbors(size_t size, size_t bit, size_t *neighbors) {
+    const size_t width = BB_WIDTH(size);
+
+    size_t count = 0;
+    if (bit >= width) {
+        neighbors[count++] = bit - width;
+    }
+    if (bit > 0) {
+        neighbors[count++] = bit - 1;
+    }
+    neighbors[count++] = bit + 1;
+    if (bit + width < size * width) {
+        neighbors[count++] = bit + width;
+    }
+
+    return count;
+}
+
+// The k-th lowest set bit of a word.
+static inline size_t _select(uint64_t word, size_t k) {
+    size_t bit = 0;
+    for (size_t half = 32; half; half /= 2) {
+        const uint64_t low = word & (((uint64_t) 1 << half) - 1);
+        const size_t count = __builtin_popcountll(low);
+        if (k >= count) {
+            k -= count;
+            word >>= half;
+            bit += half;
+        }
+        else {
+            word = low;
+        }
+    }
+    return bit;
+}
+
+// Whether the string of a stone of the given color has a liberty other
+// than the excluded bit, growing the string from the stone until the first
+// such liberty. On false, string holds the whole string.
+static bool _string_liberty(struct go_batch *batch, _board color, size_t lane,
+                            size_t stone, size_t exclude, uint64_t *string) {
+    const size_t size = batch->size;
+    const size_t words = batch->words;
+    const size_t width = BB_WIDTH(size);
+
+    size_t neighbors[4];
+    const size_t num_neighbors = _neighbors(size, stone, neighbors);
+    for (size_t i = 0; i < num_neighbors; i++) {
+        if (neighbors[i] != exclude && _test(batch->empty, lane, neighbors[i])) {
+            return true;
+        }
+    }
+
+    uint64_t libs[GO_BITBOARD_WORDS];
+    for (size_t i = 0; i < words; i++) {
+        libs[i] = batch->empty[i][lane];
+        string[i] = 0;
+    }
+    libs[exclude / 64] &= ~((uint64_t) 1 << (exclude % 64));
+    string[stone / 64] = (uint64_t) 1 << (stone % 64);
+
+    while (1) {
+        uint64_t changed = 0;
+        for (size_t i = 0; i < words; i++) {
+            const uint64_t prev = i ? string[i-1] : 0;
+            const uint64_t next = (i + 1 < words) ? string[i+1] : 0;
+            const uint64_t grown = string[i] | _adjacent(string[i], prev, next, width);
+
+            if (grown & libs[i]) {
+                return true;
+            }
+
+            const uint64_t stones = grown & color[i][lane];
+            changed |= stones ^ string[i];
+            string[i] = stones;
+        }
+
+        if (!changed) {
+            return false;
+        }
+    }
+}
+
+// Checks a stone placement on an empty point of a lane; on success, fills
+// in the opposing stones it captures.
+static bool _try_place(struct go_batch *batch, size_t lane, size_t bit, uint64_t *captured) {
+    const size_t words = batch->words;
+    _board own = (batch->turn == BLACK) ? batch->black : batch->white;
+    _board opp = (batch->turn == BLACK) ? batch->white : batch->black;
+
+    size_t neighbors[4];
+    const size_t num_neighbors = _neighbors(batch->size, bit, neighbors);
+
+    for (size_t i = 0; i < words; i++) {
+        captured[i] = 0;
+    }
+
+    // find adjacent opposing strings whose only liberty is this point
+    bool has_liberty = false;
+    bool any_captures = false;
+    for (size_t i = 0; i < num_neighbors; i++) {
+        const size_t n = neighbors[i];
+        if (_test(batch->empty, lane, n)) {
+            has_liberty = true;
+        }
+        else if (_test(opp, lane, n) && !((captured[n / 64] >> (n % 64)) & 1)) {
+            uint64_t string[GO_BITBOARD_WORDS];
+            if (!_string_liberty(batch, opp, lane, n, bit, string)) {
+                for (size_t j = 0; j < words; j++) {
+                    captured[j] |= string[j];
+                }
+                any_captures = true;
+            }
+        }
+    }
+
+    if (has_liberty || any_captures) {
+        return true;
+    }
+
+    // check for suicide: an adjacent own string needs a liberty elsewhere
+    for (size_t i = 0; i < num_neighbors; i++) {
+        uint64_t string[GO_BITBOARD_WORDS];
+        if (_test(own, lane, neighbors[i]) &&
+            _string_liberty(batch, own, lane, neighbors[i], bit, string)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Places a stone for the side to move in a lane, removing the captured
+// stones (none if captured is NULL).
+static void _place(struct go_batch *batch, size_t lane, size_t bit, const uint64_t *captured) {
+    const size_t words = batch->words;
+    _board own = (batch->turn == BLACK) ? batch->black : batch->white;
+    _board opp = (batch->turn == BLACK) ? batch->white : batch->black;
+
+    own[bit / 64][lane] |= (uint64_t) 1 << (bit % 64);
+    batch->empty[bit / 64][lane] &= ~((uint64_t) 1 << (bit % 64));
+    batch->passed[lane] = 0;
+    batch->ko[lane] = 0;
+
+    if (!captured) {
+        return;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < words; i++) {
+        opp[i][lane] &= ~captured[i];
+        batch->empty[i][lane] |= captured[i];
+        count += __builtin_popcountll(captured[i]);
+    }
+
+    // check for simple ko: a lone stone captured a lone stone and its only
+    // liberty is the captured point
+    if (count == 1) {
+        size_t neighbors[4];
+        const size_t num_neighbors = _neighbors(batch->size, bit, neighbors);
+
+        bool lone = true;
+        size_t ko = 0;
+        for (size_t i = 0; i < num_neighbors; i++) {
+            const size_t n = neighbors[i];
+            if ((captured[n / 64] >> (n % 64)) & 1) {
+                ko = n;
+            }
+            else if (_test(own, lane, n) || _test(batch->empty, lane, n)) {
+                lone = false;
+            }
+        }
+
+        if (lone) {
+            batch->ko[lane] = ko + 1;
+        }
+    }
+}
+
+//
+// batch implementation
+//
+
+void go_batch_setup(struct go_batch *batch, const struct go_state *state, size_t count) {
+    const size_t size = state->size;
+    assert(size >= 1 && size <= 21);
+    assert(count >= 1 && count <= GO_BATCH_MAX);
+    assert(!state->scored);
+
+    memset(batch, 0, sizeof(struct go_batch));
+    batch->size = size;
+    batch->words = (size * BB_WIDTH(size) + 63) / 64;
+    batch->count = count;
+    batch->turn = state->turn;
+
+    uint64_t black[GO_BITBOARD_WORDS] = {0};
+    uint64_t white[GO_BITBOARD_WORDS] = {0};
+    uint64_t empty[GO_BITBOARD_WORDS] = {0};
+
+    for (size_t row = 1; row <= size; row++) {
+        for (size_t col = 1; col <= size; col++) {
+            const size_t bit = BB_BIT(size, row, col);
+            const uint64_t mask = (uint64_t) 1 << (bit % 64);
+
+            switch (state->board[row * state->stride + col]) {
+            case BLACK: black[bit / 64] |= mask; break;
+            case WHITE: white[bit / 64] |= mask; break;
+            default:    empty[bit / 64] |= mask; break;
+            }
+
+            if (row == 1 || row == size || col == 1 || col == size) {
+                batch->edge[bit / 64] |= mask;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < batch->words; i++) {
+        for (size_t l = 0; l < count; l++) {
+            batch->black[i][l] = black[i];
+            batch->white[i][l] = white[i];
+            batch->empty[i][l] = empty[i];
+        }
+    }
+
+    uint16_t ko = 0;
+    if (state->ko != GO_MOVE_PASS) {
+        ko = BB_BIT(size, GO_MOVE_ROW(state->ko), GO_MOVE_COL(state->ko)) + 1;
+    }
+
+    for (size_t l = 0; l < count; l++) {
+        batch->ko[l] = ko;
+        batch->passed[l] = state->passed;
+    }
+}
+
+size_t go_batch_step(struct go_batch *batch) {
+    const size_t words = batch->words;
+    const size_t count = batch->count;
+
+    go_batch_board candidates;
+    go_batch_board safe;
+    _candidates(batch, candidates, safe);
+
+    size_t remaining = 0;
+    for (size_t l = 0; l < count; l++) {
+        if (batch->done[l]) {
+            continue;
+        }
+
+        if (batch->ko[l]) {
+            const size_t bit = batch->ko[l] - 1;
+            candidates[bit / 64][l] &= ~((uint64_t) 1 << (bit % 64));
+        }
+
+        size_t num_candidates = 0;
+        for (size_t i = 0; i < words; i++) {
+            num_candidates += __builtin_popcountll(candidates[i][l]);
+        }
+
+        // picks are uniform over the candidates not yet rejected
+        bool moved = false;
+        while (num_candidates) {
+            size_t k = rng_bounded(&batch->rng[l], num_candidates);
+            size_t i = 0;
+            while (k >= (size_t) __builtin_popcountll(candidates[i][l])) {
+                k -= __builtin_popcountll(candidates[i][l]);
+                i++;
+            }
+
+            const size_t bit = i * 64 + _select(candidates[i][l], k);
+            const uint64_t mask = (uint64_t) 1 << (bit % 64);
+
+            if (safe[i][l] & mask) {
+                _place(batch, l, bit, NULL);
+                moved = true;
+                break;
+            }
+
+            uint64_t captured[GO_BITBOARD_WORDS];
+            if (_try_place(batch, l, bit, captured)) {
+                _place(batch, l, bit, captured);
+                moved = true;
+                break;
+            }
+
+            candidates[i][l] &= ~mask;
+            num_candidates--;
+        }
+
+        if (!moved) {
+            if (batch->passed[l]) {
+                batch->done[l] = 1;
+            }
+            batch->passed[l] = 1;
+            batch->ko[l] = 0;
+        }
+
+        batch->num_moves[l]++;
+
+        if (!batch->done[l]) {
+            remaining++;
+        }
+    }
+
+    batch->turn ^= WHITE | BLACK;
+
+    return remaining;
+}
+
+void go_batch_run(struct go_batch *batch, size_t max_steps) {
+    for (size_t i = 0; i < max_steps; i++) {
+        if (!go_batch_step(batch)) {
+            break;
+        }
+    }
+
+    go_batch_score(batch);
+}
+
+void go_batch_score(struct go_batch *batch) {
+    const size_t words = batch->words;
+    const size_t count = batch->count;
+    const size_t width = BB_WIDTH(batch->size);
+
+    // empty points reachable from each color
+    go_batch_board black_reach;
+    go_batch_board white_reach;
+    for (size_t i = 0; i < words; i++) {
+        const uint64_t *bp = i ? batch->black[i-1] : _zero;
+        const uint64_t *bn = (i + 1 < words) ? batch->black[i+1] : _zero;
+        const uint64_t *wp = i ? batch->white[i-1] : _zero;
+        const uint64_t *wn = (i + 1 < words) ? batch->white[i+1] : _zero;
+
+        for (size_t l = 0; l < count; l++) {
+            const uint64_t e = batch->empty[i][l];
+            black_reach[i][l] = _adjacent(batch->black[i][l], bp[l], bn[l], width) & e;
+            white_reach[i][l] = _adjacent(batch->white[i][l], wp[l], wn[l], width) & e;
+        }
+    }
+
+    _flood(batch, black_reach, batch->empty);
+    _flood(batch, white_reach, batch->empty);
+
+    int16_t score[GO_BATCH_MAX] = {0};
+    for (size_t i = 0; i < words; i++) {
+        for (size_t l = 0; l < count; l++) {
+            const uint64_t b = batch->black[i][l] | (black_reach[i][l] & ~white_reach[i][l]);
+            const uint64_t w = batch->white[i][l] | (white_reach[i][l] & ~black_reach[i][l]);
+            batch->black_area[i][l] = b;
+            batch->white_area[i][l] = w;
+            score[l] += __builtin_popcountll(b) - __builtin_popcountll(w);
+        }
+    }
+
+    for (size_t l = 0; l < count; l++) {
+        batch->score[l] = score[l];
+    }
+}
+
+void go_batch_owner(const struct go_batch *batch, size_t lane, go_color *owner) {
+    const size_t size = batch->size;
+    const size_t stride = size + 2;
+
+    for (size_t row = 1; row <= size; row++) {
+        size_t bit = BB_BIT(size, row, 1);
+
+        for (size_t col = 1; col <= size; col++, bit++) {
+            const uint64_t mask = (uint64_t) 1 << (bit % 64);
+
+            go_color color = EMPTY;
+            if (batch->black_area[bit / 64][lane] & mask) {
+                color = BLACK;
+            }
+            else if (batch->white_area[bit / 64][lane] & mask) {
+                color = WHITE;
+            }
+            owner[row * stride + col] = color;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef KERPLUNK_BATCH_H_
+#define KERPLUNK_BATCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "go.h"
+#include "rng.h"
+
+//
+// lockstep batch playout engine
+//
+// Holds up to GO_BATCH_MAX independent positions of one board size as
+// bitboards (same layout as struct go_bitboard) in struct-of-arrays form:
+// word i of lane j is stored at [i][j]. All lanes advance by one random
+// move per step, so they always have the same side to move.
+//
+// Each step first works out, for every lane at once, which points are
+// candidates (empty, and not an eye of the side to move by the rule of
+// go_playout_move) and which of those are safe: next to an empty point
+// and to no opposing stone short of liberties, so a stone there is legal
+// and captures nothing. Those are loops over lanes with no branches,
+// which the compiler vectorizes. Then each lane draws its move, which
+// only needs a closer look, with the flood fills of go_bitstate, when it
+// isn't safe. Moves are drawn as go_playout_move draws them, except that
+// superko isn't checked, since no position hashes are kept.
+//
+
+#define GO_BATCH_MAX 32
+
+typedef uint64_t go_batch_board[GO_BITBOARD_WORDS][GO_BATCH_MAX];
+
+struct go_batch {
+    go_batch_board black;
+    go_batch_board white;
+    go_batch_board empty;
+
+    // final area of each color, once scored
+    go_batch_board black_area;
+    go_batch_board white_area;
+
+    uint64_t edge[GO_BITBOARD_WORDS]; // points with a diagonal off the board
+
+    // seeded by the caller
+    struct rng rng[GO_BATCH_MAX];
+
+    int16_t  score[GO_BATCH_MAX];     // raw score before komi, once scored
+    uint16_t num_moves[GO_BATCH_MAX]; // moves and passes played
+    uint16_t ko[GO_BATCH_MAX];        // bit forbidden by simple ko plus one, or 0
+    uint8_t  passed[GO_BATCH_MAX];
+    uint8_t  done[GO_BATCH_MAX];      // game ended by two passes
+
+    uint8_t  size;
+    uint8_t  words; // number of words in use
+    uint8_t  count; // number of lanes in use
+    uint8_t  turn;
+};
+
+// Fills count lanes with copies of state, which must not be finished. The
+// random generators of the lanes are left for the caller to seed.
+void go_batch_setup(struct go_batch *batch, const struct go_state *state, size_t count);
+
+// Plays one move (or pass) in every unfinished lane, returning the number
+// of lanes still unfinished.
+size_t go_batch_step(struct go_batch *batch);
+
+// Steps until every lane is finished or max_steps is reached, then scores
+// every lane.
+void go_batch_run(struct go_batch *batch, size_t max_steps);
+
+// Tromp-Taylor scores every lane, finished or not, as go_score would.
+void go_batch_score(struct go_batch *batch);
+
+// Final ownership of the points of a scored lane, indexed by the points of
+// a go_state of the same size.
+void go_batch_owner(const struct go_batch *batch, size_t lane, go_color *owner);
+
+#endif//KERPLUNK_BATCH_H_
@@ -0,0 +1,140 @@
+local kp = require('kerplunk')
+local ffi = require('ffi')
+local C = ffi.C
+
+ffi.cdef [[
+struct timespec {
+    long tv_sec;
+    long tv_nsec;
+};
+
+int clock_gettime(int clock_id, struct timespec *ts);
+]]
+
+local CLOCK_MONOTONIC = 1
+
+-- work per run at scale 1, by board size
+local PLAYOUTS = {[9] = 20000, [13] = 8000, [19] = 3000}
+local SEARCHES = {[9] = 5000, [13] = 2000, [19] = 1000}
+
+-- iterations between merges of root parallel searches
+local MERGE_INTERVAL = 100
+
+local function now()
+    local ts = ffi.new('struct timespec')
+    C.clock_gettime(CLOCK_MONOTONIC, ts)
+    return tonumber(ts.tv_sec) + tonumber(ts.tv_nsec) * 1e-9
+end
+
+-- playouts per second of the single thread run, by kind and size
+local baseline = {}
+
+local function report(kind, size, threads, seconds, playouts, moves, nodes)
+    local key = kind .. size
+    if threads == 1 then
+        baseline[key] = playouts / seconds
+    end
+
+    print(string.format('%s\t%d\t%d\t%.3f\t%d\t%d\t%d\t%.1f\t%.1f\t%.1f\t%.2f',
+                        kind, size, threads, seconds, playouts, moves, nodes,
+                        playouts / seconds, moves / seconds, nodes / seconds,
+                        playouts / seconds / baseline[key]))
+    io.stdout:flush()
+end
+
+-- Uniform random playouts from the empty board, spread over the pool.
+local function bench_playouts(size, threads, count, seed)
+    local state = ffi.new('struct go_state')
+    local result = ffi.new('struct playout_result')
+    C.go_setup(state, size, 0, nil)
+
+    if not C.mc_set_threads(threads) then
+        return false
+    end
+
+    C.rng_set_seed(seed)
+    local start = now()
+    if not C.mc_run_playouts(state, count, result) then
+        return false
+    end
+    local seconds = now() - start
+
+    report('playout', size, threads, seconds,
+           tonumber(result.num_playouts), tonumber(result.stats.num_moves), 0)
+    return true
+end
+
+-- Tree search iterations with uniform random playouts from the empty board,
+-- all threads searching the same tree (kind search) or private trees merged
+-- at the root (kind root).
+local function bench_search(kind, size, threads, count, seed)
+    local state = ffi.new('struct go_state')
+    C.go_setup(state, size, 0, nil)
+
+    if not C.mc_set_threads(threads) then
+        return false
+    end
+
+    C.rng_set_seed(seed)
+    local tree = C.mcts_new(state)
+    if tree == nil then
+        return false
+    end
+
+    local start = now()
+    local ok
+    if kind == 'root' then
+        ok = C.mcts_run_playouts_root(tree, nil, count, MERGE_INTERVAL)
+    else
+        ok = C.mcts_run_playouts(tree, nil, count)
+    end
+    local seconds = now() - start
+
+    if not ok then
+        C.mcts_free(tree)
+        return false
+    end
+
+    -- nodes of private trees are not counted
+    report(kind, size, threads, seconds, count, 0, tonumber(C.mcts_count_nodes(tree)))
+    C.mcts_free(tree)
+    return true
+end
+
+-- Usage: bench [max threads [scale [seed]]]
+--
+-- Prints one tab-separated line per run: kind (playout, search or root), board
+-- size, threads, seconds, playouts, moves, nodes, then playouts, moves and
+-- nodes per second, and the speedup over one thread. Moves are not counted
+-- for searches.
+function main(max_threads, scale, seed)
+    max_threads = tonumber(max_threads) or tonumber(C.mc_get_threads())
+    scale = tonumber(scale) or 1
+    seed = tonumber(seed) or 1
+
+    print('kind\tsize\tthreads\tseconds\tplayouts\tmoves\tnodes\tplayouts/s\tmoves/s\tnodes/s\tspeedup')
+
+    for _, size in ipairs({9, 13, 19}) do
+        local count = math.max(1, math.floor(PLAYOUTS[size] * scale))
+        for threads = 1, max_threads do
+            if not bench_playouts(size, threads, count, seed) then
+                io.stderr:write('bench: playouts failed\n')
+                return -1
+            end
+        end
+
+        count = math.max(1, math.floor(SEARCHES[size] * scale))
+        for _, kind in ipairs({'search', 'root'}) do
+            for threads = 1, max_threads do
+                if not bench_search(kind, size, threads, count, seed) then
+                    io.stderr:write('bench: search failed\n')
+                    return -1
+                end
+            end
+        end
+    end
+
+    return 0
+end
+
+return {main=main}
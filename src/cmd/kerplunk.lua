@@ -6,26 +6,122 @@ ffi.cdef [[
 
 // from go.h
 struct go_state {
-    uint8_t  board[24][32];
-
     uint64_t hash;
 
     uint8_t  size; // max 21, to limit valid positions to 512
+    uint8_t  stride; // size + 2
     uint8_t  turn;
     uint8_t  passed;
     uint8_t  scored;
     int16_t  score; // raw score before komi
     uint16_t bcaps; // black stones captured, not stones captured _by_ black
     uint16_t wcaps; // ditto
+    uint16_t ko;    // move forbidden by simple ko, or GO_MOVE_PASS
+
+    struct go_history *history;
+    struct go_changes *changes;
+
+    uint8_t  board[529];
+
+    uint16_t string[529];
+    uint16_t next[529];
+    uint8_t  libs[529];
+    uint8_t  stones[529];
+
+    uint16_t num_empties;
+    uint16_t empties[441];
+    uint16_t empty_index[529];
+    uint8_t  legal[529];
+    uint16_t pattern[529];
 };
 
+void go_copy(const struct go_state *state, struct go_state *out);
+bool go_equal(const struct go_state *s0, const struct go_state *s1);
 void go_setup(struct go_state *state, size_t size, size_t hcap, uint16_t *hcaps);
 bool go_play(struct go_state *state, uint16_t move);
-bool go_legal(struct go_state *state, uint16_t move);
-void go_moves(struct go_state *state, uint16_t *moves, size_t *count);
-void go_moves_loose(struct go_state *state, uint16_t *moves, size_t *count);
+bool go_legal(const struct go_state *state, uint16_t move);
+int16_t go_score(const struct go_state *state, uint8_t *owner);
+void go_moves(const struct go_state *state, uint16_t *moves, size_t *count);
+void go_moves_loose(const struct go_state *state, uint16_t *moves, size_t *count);
+bool go_is_eye(const struct go_state *state, uint16_t move, uint8_t color);
 void go_print(struct go_state *state, void *stream);
 
+// from rng.h
+struct rng {
+    uint64_t s[4];
+};
+
+void rng_set_seed(uint64_t seed);
+uint64_t rng_get_seed(void);
+void rng_init(struct rng *rng, uint64_t stream);
+
+// from mcts.h
+struct mc_amaf;
+struct mc_policy;
+struct mcts_tree;
+
+struct mc_stats {
+    size_t num_playouts;
+    size_t num_moves;
+    size_t num_capped;
+};
+
+struct playout_result {
+    size_t num_playouts;
+    size_t num_black_wins;
+    double mean_score;
+    uint32_t histogram[883];
+    struct mc_stats stats;
+};
+
+struct mc_ownership {
+    uint8_t  size;
+    uint8_t  stride;
+    uint32_t num_playouts;
+    uint32_t num_black_wins;
+
+    uint32_t black[529];
+    uint32_t white[529];
+    uint32_t winner[529];
+};
+
+int16_t mc_run_random_playout(struct go_state *state, struct rng *rng,
+                              struct mc_amaf *amaf, struct mc_stats *stats);
+
+bool mc_run_playouts(const struct go_state *state, size_t n, struct playout_result *result);
+bool mc_run_ownership(const struct go_state *state, size_t n, struct playout_result *result,
+                      struct mc_ownership *ownership);
+bool mc_set_threads(size_t num_threads);
+size_t mc_get_threads(void);
+
+struct mcts_tree *mcts_new(struct go_state *state);
+void mcts_free(struct mcts_tree *tree);
+size_t mcts_count_nodes(const struct mcts_tree *tree);
+bool mcts_track_ownership(struct mcts_tree *tree);
+const struct mc_ownership *mcts_ownership(const struct mcts_tree *tree);
+bool mcts_run_playouts(struct mcts_tree *tree, const struct mc_policy *policy, size_t n);
+bool mcts_run_playouts_root(struct mcts_tree *tree, const struct mc_policy *policy,
+                            size_t n, size_t merge_interval);
+
+uint16_t mcts_choose(struct mcts_tree *tree, struct rng *rng);
+
+struct search_limits {
+    double seconds;
+    size_t max_playouts;
+    size_t max_nodes;
+    bool early_stop;
+    const struct mc_policy *policy;
+};
+
+size_t mcts_search(struct mcts_tree *tree, const struct search_limits *limits);
+double mcts_allot_time(double main_time, const struct go_state *state);
+
+void mc_ownership_init(struct mc_ownership *ownership, const struct go_state *state);
+void mc_ownership_add(struct mc_ownership *ownership, const uint8_t *owner, bool black_won);
+double mc_ownership_value(const struct mc_ownership *ownership, uint16_t move);
+double mc_ownership_criticality(const struct mc_ownership *ownership, uint16_t move);
+double mc_ownership_score(const struct mc_ownership *ownership);
+
 // from record.h
 struct game_record {
 
@@ -89,6 +185,22 @@ function kerplunk.go_print(state, ...)
     C.go_print(state, stream)
 end
 
+-- Runs random playouts from a position on the worker pool, returning a
+-- struct mc_ownership with the final ownership of every point (see
+-- mc_ownership_value, mc_ownership_criticality and mc_ownership_score),
+-- or nil if memory ran out. Winners are decided with the playout komi.
+function kerplunk.ownership(state, playouts)
+    local ownership = ffi.new('struct mc_ownership')
+    local result = ffi.new('struct playout_result')
+
+    C.mc_ownership_init(ownership, state)
+    if not C.mc_run_ownership(state, playouts, result, ownership) then
+        return nil
+    end
+
+    return ownership
+end
+
 function kerplunk.new_replay(record)
     local replay = ffi.new('struct game_replay')
 
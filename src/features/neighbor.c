@@ -41,7 +41,7 @@ void feature_neighborhood(struct go_state *state, go_move pos, go_color *buffer,
     size_t i = 0;
     const uint8_t row = GO_MOVE_ROW(pos);
     const uint8_t col = GO_MOVE_COL(pos);
-    buffer[i] = state->board[row][col];
+    buffer[i] = state->board[row * state->stride + col];
     i++;
 
     for (size_t r = 1; r <= max_radius; r++) {
@@ -68,7 +68,7 @@ void feature_neighborhood(struct go_state *state, go_move pos, go_color *buffer,
                     color = GO_COLOR_EMPTY;
                 }
                 else {
-                    color = state->board[r][c];
+                    color = state->board[r * state->stride + c];
                 }
 
                 buffer[i] = color;
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
@@ -6,6 +7,7 @@
 #include <sodium.h>
 
 #include "go.h"
+#include "rng.h"
 
 #define MAX_STRINGSIZE 512
 
@@ -14,14 +16,55 @@
 #define EMPTY GO_COLOR_EMPTY
 #define BLACK GO_COLOR_BLACK
 #define WHITE GO_COLOR_WHITE
+#define OFFBOARD GO_COLOR_OFFBOARD
 #define VISITED 4 // temporary mark for flood fills
 
+// the four orthogonal neighbors of a point on the padded board
+
+#define NEIGHBORS(state, p) {(p) - (state)->stride, (p) - 1, (p) + 1, (p) + (state)->stride}
+
+// the eight surrounding points, in row-major order
+
+#define NEIGHBORS8(state, p) { \
+    (p) - (state)->stride - 1, (p) - (state)->stride, (p) - (state)->stride + 1, \
+    (p) - 1, (p) + 1, \
+    (p) + (state)->stride - 1, (p) + (state)->stride, (p) + (state)->stride + 1}
+
+// undo logging: records the old value of a field before it is modified,
+// if an undo log is active
+
+#define LOG(field) do { if (undo) _undo_log(undo, state, &(field)); } while (0)
+
+// upper bound on the log entries written by a single move
+#define UNDO_RESERVE 16384
+
+// liberty and stone counts stop here, meaning this many or more
+#define MAX_COUNT 255
+
 // utility functions
 
-static bool _try_capture(struct go_state *state, size_t row, size_t col, bool pretend);
-static void _score(struct go_state *state);
+static bool _play(struct go_state *state, go_move move, struct go_undo *undo);
+static void _place_stone(struct go_state *state, go_point point, struct go_undo *undo);
+static size_t _remove_string(struct go_state *state, go_point head, struct go_undo *undo);
+static go_point _merge_strings(struct go_state *state, go_point head0, go_point head1, struct go_undo *undo);
+static inline void _undo_log(struct go_undo *undo, struct go_state *state, void *field);
+static uint16_t _count_liberties(struct go_state *state, go_point head);
+static void _remove_empty(struct go_state *state, go_point point, struct go_undo *undo);
+static void _add_empty(struct go_state *state, go_point point, struct go_undo *undo);
+static void _refresh_point(struct go_state *state, go_point point, struct go_undo *undo);
+static void _refresh_liberties(struct go_state *state, go_point head, struct go_undo *undo);
+static inline void _note_change(struct go_state *state, go_point point);
+static uint64_t _next_hash(const struct go_state *state, go_point point);
+
+static inline uint8_t _saturate(size_t count) {
+    return (count < MAX_COUNT) ? count : MAX_COUNT;
+}
+
+static uint64_t _go_pos_hash[GO_MAX_POINTS][2];
 
-static uint64_t _go_pos_hash[24][32][2];
+static struct go_bitboard _bb_on_board[22];
+static struct go_bitboard _bb_edge[22]; // points with a diagonal off the board
+static void _bb_init(void);
 
 bool go_init(void) {
     
@@ -34,16 +77,78 @@ bool go_init(void) {
     const uint8_t n[32] = "00000000000000000000000000000000";
     crypto_stream_chacha20((void*) _go_pos_hash, sizeof(_go_pos_hash), n, k);
 
+    _bb_init();
+
     return true;
 }
 
+void go_copy(const struct go_state *state, struct go_state *out) {
+    const size_t points = (size_t) state->stride * state->stride;
+
+    // one copy of everything beats ten small ones once most points are used
+    if (2 * points > GO_MAX_POINTS) {
+        memcpy(out, state, sizeof(struct go_state));
+        return;
+    }
+
+    memcpy(out, state, offsetof(struct go_state, board));
+    memcpy(out->board, state->board, points * sizeof(go_color));
+    memcpy(out->string, state->string, points * sizeof(go_point));
+    memcpy(out->next, state->next, points * sizeof(go_point));
+    memcpy(out->libs, state->libs, points * sizeof(uint8_t));
+    memcpy(out->stones, state->stones, points * sizeof(uint8_t));
+    out->num_empties = state->num_empties;
+    memcpy(out->empties, state->empties, state->num_empties * sizeof(go_point));
+    memcpy(out->empty_index, state->empty_index, points * sizeof(uint16_t));
+    memcpy(out->legal, state->legal, points * sizeof(uint8_t));
+    memcpy(out->pattern, state->pattern, points * sizeof(uint16_t));
+}
+
+bool go_equal(const struct go_state *s0, const struct go_state *s1) {
+    if (s0->stride != s1->stride || s0->num_empties != s1->num_empties) {
+        return false;
+    }
+
+    const size_t points = (size_t) s0->stride * s0->stride;
+    return !memcmp(s0, s1, offsetof(struct go_state, board)) &&
+        !memcmp(s0->board, s1->board, points * sizeof(go_color)) &&
+        !memcmp(s0->string, s1->string, points * sizeof(go_point)) &&
+        !memcmp(s0->next, s1->next, points * sizeof(go_point)) &&
+        !memcmp(s0->libs, s1->libs, points * sizeof(uint8_t)) &&
+        !memcmp(s0->stones, s1->stones, points * sizeof(uint8_t)) &&
+        !memcmp(s0->empties, s1->empties, s0->num_empties * sizeof(go_point)) &&
+        !memcmp(s0->empty_index, s1->empty_index, points * sizeof(uint16_t)) &&
+        !memcmp(s0->legal, s1->legal, points * sizeof(uint8_t)) &&
+        !memcmp(s0->pattern, s1->pattern, points * sizeof(uint16_t));
+}
+
 void go_setup(struct go_state *state, size_t size, size_t hcap, go_move *hcaps) {
     assert(size <= 21);
 
-    // initialize blank board
+    // initialize blank board surrounded by sentinels
     memset(state, 0, sizeof(struct go_state));
     state->size = size;
-    state->turn = (hcap == 0) ? BLACK : WHITE;
+    state->stride = size + 2;
+    state->turn = BLACK;
+
+    for (size_t row = 0; row < state->stride; row++) {
+        for (size_t col = 0; col < state->stride; col++) {
+            const go_point point = row * state->stride + col;
+
+            if (row == 0 || row > size || col == 0 || col > size) {
+                state->board[point] = OFFBOARD;
+            }
+            else {
+                state->empty_index[point] = state->num_empties;
+                state->empties[state->num_empties] = point;
+                state->num_empties++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < state->num_empties; i++) {
+        _refresh_point(state, state->empties[i], NULL);
+    }
 
     if (hcap) {
         assert(hcaps != NULL);
@@ -54,244 +159,477 @@ void go_setup(struct go_state *state, size_t size, size_t hcap, go_move *hcaps)
         const uint8_t col = GO_MOVE_COL(hcaps[i]);
         assert(row > 0 && row <= size && col > 0 && col <= size);
 
-        assert(state->board[row][col] == EMPTY);
-        state->board[row][col] = BLACK;
-        state->hash ^= _go_pos_hash[row][col][0];
+        const go_point point = GO_POINT(state, hcaps[i]);
+        assert(state->board[point] == EMPTY);
+        _place_stone(state, point, NULL);
+    }
+
+    state->turn = (hcap == 0) ? BLACK : WHITE;
+}
+
+// Collects the distinct strings adjacent to a point. Returns the number of
+// heads written to the buffer (at most 4).
+static inline size_t _neighbor_strings(const struct go_state *state, go_point point, go_point heads[4]) {
+    const go_point N[4] = NEIGHBORS(state, point);
+
+    size_t count = 0;
+    for (size_t i = 0; i < 4; i++) {
+        if (state->board[N[i]] != BLACK && state->board[N[i]] != WHITE) {
+            continue;
+        }
+
+        const go_point head = state->string[N[i]];
+        bool seen = false;
+        for (size_t j = 0; j < count; j++) {
+            if (heads[j] == head) {
+                seen = true;
+            }
+        }
+
+        if (!seen) {
+            heads[count] = head;
+            count++;
+        }
     }
+
+    return count;
 }
 
-static bool _try_capture(struct go_state *state, size_t row, size_t col, bool pretend) {
-    uint8_t stack[MAX_STRINGSIZE][2];
-    uint8_t list[MAX_STRINGSIZE][2];
-    size_t stack_next = 0;
-    size_t list_next = 0;
+// Places a stone of the current player's color and updates string
+// membership, liberties and captures. The move must be legal.
+static void _place_stone(struct go_state *state, go_point point, struct go_undo *undo) {
+    const go_color own_color = state->turn;
+    const go_point N[4] = NEIGHBORS(state, point);
 
-    const size_t size = state->size;
-    assert(size <= 21);
+    go_point heads[4];
+    const size_t num_heads = _neighbor_strings(state, point, heads);
 
-    const go_color color = state->board[row][col];
+    _remove_empty(state, point, undo);
 
-    // push initial element
-    stack[0][0] = row;
-    stack[0][1] = col;
-    stack_next++;
+    uint16_t own_libs = 0;
+    for (size_t i = 0; i < 4; i++) {
+        if (state->board[N[i]] == EMPTY) {
+            own_libs++;
+        }
+    }
 
-    // DFS of connected stones to find liberties (and mark string)
-    while (stack_next) {
+    // place stone as a new single-stone string
+    LOG(state->board[point]);
+    LOG(state->string[point]);
+    LOG(state->next[point]);
+    LOG(state->stones[point]);
+    LOG(state->libs[point]);
+    state->board[point] = own_color;
+    state->string[point] = point;
+    state->next[point] = point;
+    state->stones[point] = 1;
+    state->libs[point] = own_libs;
+    state->hash ^= _go_pos_hash[point][own_color-1];
+
+    // the new stone fills a liberty of every adjacent string
+    bool own_atari = false;
+    for (size_t i = 0; i < num_heads; i++) {
+        LOG(state->libs[heads[i]]);
+        if (state->libs[heads[i]] == MAX_COUNT) {
+            // the old count is only a lower bound
+            state->libs[heads[i]] = _saturate(_count_liberties(state, heads[i]));
+        }
+        else {
+            state->libs[heads[i]]--;
+        }
 
-        // pop location
-        uint8_t r = stack[stack_next-1][0];
-        uint8_t c = stack[stack_next-1][1];
-        stack_next--;
+        if (state->board[heads[i]] == own_color && state->libs[heads[i]] == 0) {
+            // was in atari before joining the new stone
+            own_atari = true;
+        }
+    }
 
-        if (state->board[r][c] & VISITED) {
+    // join adjacent friendly strings
+    go_point head = point;
+    size_t num_merged = 0;
+    for (size_t i = 0; i < num_heads; i++) {
+        if (state->board[heads[i]] != own_color) {
             continue;
         }
 
-        // check neighbors
-        uint8_t N[4][2] = {{r-1, c}, {r+1, c}, {r, c-1}, {r, c+1}};
-        for (size_t i = 0; i < 4; i++) {
-            uint8_t r1 = N[i][0];
-            uint8_t c1 = N[i][1];
-
-            if (state->board[r1][c1] == color) {
-                // note: this precludes (r1, c1) being marked VISITED
-
-                // push neighbor
-                stack[stack_next][0] = r1;
-                stack[stack_next][1] = c1;
-                stack_next++;
-                
-                assert(stack_next <= MAX_STRINGSIZE);
-            }
-            else if (state->board[r1][c1] == EMPTY) {
-                if (r1 && r1 <= size && c1 && c1 <= size) {
-                    // found liberty, no capture
-                    
-                    // clean up marks
-                    for (size_t j = 0; j < list_next; j++) {
-                        state->board[list[j][0]][list[j][1]] &= ~VISITED;
+        if (num_merged == 0) {
+            // liberties of the new stone not already shared with the string
+            size_t libs = state->libs[heads[i]];
+            for (size_t j = 0; j < 4; j++) {
+                if (state->board[N[j]] != EMPTY) {
+                    continue;
+                }
+
+                const go_point M[4] = NEIGHBORS(state, N[j]);
+                bool shared = false;
+                for (size_t k = 0; k < 4; k++) {
+                    if (state->board[M[k]] == own_color &&
+                        state->string[M[k]] == heads[i]) {
+                        shared = true;
                     }
+                }
 
-                    return false;
+                if (!shared) {
+                    libs++;
                 }
             }
+
+            head = _merge_strings(state, head, heads[i], undo);
+            LOG(state->libs[head]);
+            state->libs[head] = _saturate(libs);
+        }
+        else {
+            head = _merge_strings(state, head, heads[i], undo);
         }
-        
-        // add to visited list
-        list[list_next][0] = r;
-        list[list_next][1] = c;
-        list_next++;
-        
-        assert(list_next <= MAX_STRINGSIZE);
 
-        state->board[r][c] |= VISITED;
+        num_merged++;
     }
 
-    // no liberties found
-
-    if (!pretend) {
-    
-        // remove all marked positions
-        uint64_t hash_delta = 0;
-        for (size_t j = 0; j < list_next; j++) {
-            const uint8_t r = list[j][0];
-            const uint8_t c = list[j][1];
+    if (num_merged > 1) {
+        // liberties may be shared between the joined strings
+        LOG(state->libs[head]);
+        state->libs[head] = _saturate(_count_liberties(state, head));
+    }
 
-            hash_delta ^= _go_pos_hash[r][c][color-1];
-            state->board[r][c] = EMPTY;
+    // remove adjacent opposing strings without liberties
+    size_t captured = 0;
+    go_point last_captured = 0;
+    for (size_t i = 0; i < num_heads; i++) {
+        if (state->board[heads[i]] != own_color &&
+            state->libs[heads[i]] == 0) {
+            captured += _remove_string(state, heads[i], undo);
+            last_captured = heads[i];
         }
+    }
 
-        // record capture counts
-        if (color == BLACK) {
-            state->bcaps += list_next;
-        }
-        else {
-            state->wcaps += list_next;
-        }
-        
-        state->hash ^= hash_delta;
+    // a lone stone that captured a lone stone and is left with one liberty
+    // can be recaptured immediately at the captured point
+    if (captured == 1 && state->stones[head] == 1 && state->libs[head] == 1) {
+        state->ko = GO_POINT_MOVE(state, last_captured);
     }
     else {
+        state->ko = GO_MOVE_PASS;
+    }
 
-        // just remove marks
-        for (size_t j = 0; j < list_next; j++) {
-            state->board[list[j][0]][list[j][1]] &= ~VISITED;
+    // refresh cached legality and patterns around the points whose
+    // surroundings changed; captured points were already refreshed by
+    // _remove_string
+    const go_point N8[8] = NEIGHBORS8(state, point);
+    for (size_t i = 0; i < 8; i++) {
+        if (state->board[N8[i]] == EMPTY) {
+            _refresh_point(state, N8[i], undo);
         }
     }
 
-    return true;
+    for (size_t i = 0; i < num_heads; i++) {
+        if (state->board[heads[i]] != own_color && 
+            state->board[heads[i]] != EMPTY &&
+            state->libs[heads[i]] == 1) {
+            // opposing string put in atari
+            _refresh_liberties(state, heads[i], undo);
+        }
+    }
+
+    if (own_atari || state->libs[head] == 1) {
+        _refresh_liberties(state, head, undo);
+    }
 }
 
-static void _score(struct go_state *state) {
-    uint8_t stack[MAX_STRINGSIZE][2];
-    uint8_t list[MAX_STRINGSIZE][2];
+// Joins two strings of the same color, relabeling the smaller one. Returns
+// the head of the joined string; its liberty count is left to the caller.
+static go_point _merge_strings(struct go_state *state, go_point head0, go_point head1, struct go_undo *undo) {
+    if (state->stones[head0] > state->stones[head1]) {
+        const go_point tmp = head0;
+        head0 = head1;
+        head1 = tmp;
+    }
 
-    const size_t size = state->size;
-    assert(size <= 19);
+    // relabel stones of head0's string
+    go_point stone = head0;
+    do {
+        LOG(state->string[stone]);
+        state->string[stone] = head1;
+        stone = state->next[stone];
+    } while (stone != head0);
+
+    // splice circular lists
+    const go_point next0 = state->next[head0];
+    LOG(state->next[head0]);
+    LOG(state->next[head1]);
+    state->next[head0] = state->next[head1];
+    state->next[head1] = next0;
+
+    LOG(state->stones[head1]);
+    state->stones[head1] = _saturate(state->stones[head0] + state->stones[head1]);
+
+    return head1;
+}
 
-    // fill in or mark all holes
-    size_t row = 1;
-    size_t col = 1;
-    while (1) {
+// Counts the distinct liberties of a string with a flood over its stones.
+static uint16_t _count_liberties(struct go_state *state, go_point head) {
+    go_point list[MAX_STRINGSIZE];
+    size_t list_next = 0;
 
-        // find next unvisited hole
-        while (state->board[row][col] != EMPTY) {
-            col++;
-            if (col > size) {
-                col = 0;
-                row++;
-                if (row > size) {
-                    break;
-                }
-            }
-        }
+    go_point stone = head;
+    do {
+        const go_point N[4] = NEIGHBORS(state, stone);
+        for (size_t i = 0; i < 4; i++) {
+            if (state->board[N[i]] == EMPTY) {
+                state->board[N[i]] |= VISITED;
+                list[list_next] = N[i];
+                list_next++;
 
-        if (row > size) {
-            break;
+                assert(list_next <= MAX_STRINGSIZE);
+            }
         }
-    
-        size_t stack_next = 0;
-        size_t list_next = 0;
 
-        // push initial element
-        stack[0][0] = row;
-        stack[0][1] = col;
-        stack_next++;
+        stone = state->next[stone];
+    } while (stone != head);
 
-        // DFS to find extent of hole and who owns it
-        bool white_edge = false;
-        bool black_edge = false;
-        while (stack_next) {
+    // clean up marks
+    for (size_t j = 0; j < list_next; j++) {
+        state->board[list[j]] &= ~VISITED;
+    }
 
-            // pop location
-            uint8_t r = stack[stack_next-1][0];
-            uint8_t c = stack[stack_next-1][1];
-            stack_next--;
+    return list_next;
+}
 
-            if (state->board[r][c] & VISITED) {
-                continue;
+// Removes a captured string, crediting its points as liberties to the
+// adjacent strings of the other color. Returns the number of stones removed.
+static size_t _remove_string(struct go_state *state, go_point head, struct go_undo *undo) {
+    const go_color color = state->board[head];
+
+    uint64_t hash_delta = 0;
+    size_t count = 0;
+
+    go_point stone = head;
+    do {
+        const go_point next = state->next[stone];
+
+        LOG(state->board[stone]);
+        state->board[stone] = EMPTY;
+        _add_empty(state, stone, undo);
+        hash_delta ^= _go_pos_hash[stone][color-1];
+        count++;
+
+        go_point heads[4];
+        const size_t num_heads = _neighbor_strings(state, stone, heads);
+        for (size_t i = 0; i < num_heads; i++) {
+            if (state->board[heads[i]] != color && state->libs[heads[i]] < MAX_COUNT) {
+                LOG(state->libs[heads[i]]);
+                state->libs[heads[i]]++;
             }
+        }
 
-            // check neighbors
-            uint8_t N[4][2] = {{r-1, c}, {r+1, c}, {r, c-1}, {r, c+1}};
-            for (size_t i = 0; i < 4; i++) {
-                uint8_t r1 = N[i][0];
-                uint8_t c1 = N[i][1];
+        stone = next;
+    } while (stone != head);
 
-                if (state->board[r1][c1] == EMPTY) {
-                    // note: this precludes (r1, c1) being marked VISITED
+    // record capture counts
+    if (color == BLACK) {
+        state->bcaps += count;
+    }
+    else {
+        state->wcaps += count;
+    }
 
-                    if (r1 && r1 <= size && c1 && c1 <= size) {
-                        // push neighbor
-                        stack[stack_next][0] = r1;
-                        stack[stack_next][1] = c1;
-                        stack_next++;
+    state->hash ^= hash_delta;
 
-                        assert(stack_next <= MAX_STRINGSIZE);
-                    }
-                }
-                else if (state->board[r1][c1] == BLACK) {
-                    black_edge = true;
-                }
-                else if (state->board[r1][c1] == WHITE) {
-                    white_edge = true;
-                }
-            }
-            
-            // add to visited list
-            list[list_next][0] = r;
-            list[list_next][1] = c;
-            list_next++;
-            
-            assert(list_next <= MAX_STRINGSIZE);
+    // refresh cached legality and patterns of the freed points, and of the
+    // liberties of the strings that surrounded them
+    go_point neighbors[MAX_STRINGSIZE];
+    size_t num_neighbors = 0;
 
-            state->board[r][c] |= VISITED;
-        }
+    stone = head;
+    do {
+        _refresh_point(state, stone, undo);
 
-        if (white_edge == black_edge) {
-            // no owner, leave marks
+        const go_point N8[8] = NEIGHBORS8(state, stone);
+        for (size_t i = 0; i < 8; i++) {
+            if (state->board[N8[i]] == EMPTY) {
+                _refresh_point(state, N8[i], undo);
+            }
         }
-        else if (black_edge) {
 
-            // owned by black
-            for (size_t j = 0; j < list_next; j++) {
-                state->board[list[j][0]][list[j][1]] = BLACK;
+        go_point heads[4];
+        const size_t num_heads = _neighbor_strings(state, stone, heads);
+        for (size_t i = 0; i < num_heads; i++) {
+            bool seen = false;
+            for (size_t j = 0; j < num_neighbors; j++) {
+                if (neighbors[j] == heads[i]) {
+                    seen = true;
+                    break;
+                }
             }
-        }
-        else if (white_edge) {
 
-            // owned by white
-            for (size_t j = 0; j < list_next; j++) {
-                state->board[list[j][0]][list[j][1]] = WHITE;
+            if (!seen) {
+                assert(num_neighbors < MAX_STRINGSIZE);
+                neighbors[num_neighbors] = heads[i];
+                num_neighbors++;
             }
         }
+
+        stone = state->next[stone];
+    } while (stone != head);
+
+    for (size_t i = 0; i < num_neighbors; i++) {
+        _refresh_liberties(state, neighbors[i], undo);
     }
 
-    // remove all marks and tally score
-    int16_t black_count = 0;
-    int16_t white_count = 0;
-    for (size_t r = 1; r <= size; r++) {
-        for (size_t c = 1; c <= size; c++) {
-            if (state->board[r][c] == BLACK) {
-                black_count++;
-            }
-            else if (state->board[r][c] == WHITE) {
-                white_count++;
+    return count;
+}
+
+//
+// empty point list, legality cache and pattern codes
+//
+
+static void _remove_empty(struct go_state *state, go_point point, struct go_undo *undo) {
+    const uint16_t index = state->empty_index[point];
+    const go_point last = state->empties[state->num_empties - 1];
+    assert(state->empties[index] == point);
+
+    // swap with the last entry
+    LOG(state->empties[index]);
+    LOG(state->empty_index[last]);
+    LOG(state->num_empties);
+    state->empties[index] = last;
+    state->empty_index[last] = index;
+    state->num_empties--;
+
+    _note_change(state, point);
+}
+
+static void _add_empty(struct go_state *state, go_point point, struct go_undo *undo) {
+    LOG(state->empties[state->num_empties]);
+    LOG(state->empty_index[point]);
+    LOG(state->num_empties);
+    state->empties[state->num_empties] = point;
+    state->empty_index[point] = state->num_empties;
+    state->num_empties++;
+
+    _note_change(state, point);
+}
+
+static inline void _note_change(struct go_state *state, go_point point) {
+    struct go_changes *changes = state->changes;
+    if (!changes) {
+        return;
+    }
+
+    if (changes->count < GO_MAX_CHANGES) {
+        changes->points[changes->count] = point;
+        changes->count++;
+    }
+    else {
+        changes->overflow = true;
+    }
+}
+
+// Whether a stone of the given color on an empty point would have a
+// liberty, either directly, through a friendly string, or by capturing.
+static inline bool _legal_for(const struct go_state *state, go_point point, go_color color) {
+    const go_color opp_color = color ^ (WHITE | BLACK);
+
+    const go_point N[4] = NEIGHBORS(state, point);
+    for (size_t i = 0; i < 4; i++) {
+        const go_color neighbor = state->board[N[i]];
+
+        if (neighbor == EMPTY) {
+            // has a liberty
+            return true;
+        }
+        else if (neighbor == color) {
+            if (state->libs[state->string[N[i]]] > 1) {
+                // joins a string with another liberty
+                return true;
             }
-            else {
-                state->board[r][c] = EMPTY;
+        }
+        else if (neighbor == opp_color) {
+            if (state->libs[state->string[N[i]]] == 1) {
+                // captures
+                return true;
             }
         }
     }
 
-    state->score = black_count - white_count;
-    state->scored = 1;
+    // suicide
+    return false;
+}
+
+static inline go_pattern _pattern(const struct go_state *state, go_point point) {
+    go_pattern pattern = 0;
+
+    const go_point N8[8] = NEIGHBORS8(state, point);
+    for (size_t i = 0; i < 8; i++) {
+        pattern |= (go_pattern) state->board[N8[i]] << (2 * i);
+    }
+
+    const go_point N[4] = NEIGHBORS(state, point);
+    for (size_t i = 0; i < 4; i++) {
+        const go_color color = state->board[N[i]];
+        if ((color == BLACK || color == WHITE) && state->libs[state->string[N[i]]] == 1) {
+            pattern |= (go_pattern) 1 << (16 + i);
+        }
+    }
+
+    return pattern;
+}
+
+// Recomputes the legality bits and pattern code of one empty point. Both
+// only depend on the colors around the point and on whether the adjacent
+// strings are in atari, so a move only needs to refresh the points around
+// it and the liberties of strings that entered or left atari.
+static void _refresh_point(struct go_state *state, go_point point, struct go_undo *undo) {
+    assert(state->board[point] == EMPTY);
+
+    bool changed = false;
+
+    // the color bits go in the pattern cache, the atari bits along with
+    // the legality bits
+    const go_pattern pattern = _pattern(state, point);
+    if (state->pattern[point] != (uint16_t) pattern) {
+        LOG(state->pattern[point]);
+        state->pattern[point] = pattern;
+        changed = true;
+    }
+
+    uint8_t legal = (pattern >> 16) << 4;
+    if (_legal_for(state, point, BLACK)) {
+        legal |= BLACK;
+    }
+    if (_legal_for(state, point, WHITE)) {
+        legal |= WHITE;
+    }
+
+    if (state->legal[point] != legal) {
+        LOG(state->legal[point]);
+        state->legal[point] = legal;
+        changed = true;
+    }
+
+    if (changed) {
+        _note_change(state, point);
+    }
+}
+
+static void _refresh_liberties(struct go_state *state, go_point head, struct go_undo *undo) {
+    go_point stone = head;
+    do {
+        const go_point N[4] = NEIGHBORS(state, stone);
+        for (size_t i = 0; i < 4; i++) {
+            if (state->board[N[i]] == EMPTY) {
+                _refresh_point(state, N[i], undo);
+            }
+        }
+
+        stone = state->next[stone];
+    } while (stone != head);
+}
 
-    return;
+bool go_play(struct go_state *state, go_move move) {
+    return _play(state, move, NULL);
 }
 
-bool go_play(struct go_state *state, uint16_t move) {
+static bool _play(struct go_state *state, go_move move, struct go_undo *undo) {
     const size_t size = state->size;
     assert(size <= 21);
 
@@ -303,88 +641,156 @@ bool go_play(struct go_state *state, uint16_t move) {
     if (!move) {
         if (state->passed) {
             // game over, score
-            _score(state);
+            state->score = go_score(state, NULL);
+            state->scored = 1;
         }
         else {
             // normal pass (set flag)
             state->passed = 1;
         }
+
+        state->ko = GO_MOVE_PASS;
     }    
     else {
-        const go_color own_color = state->turn;
-        const go_color opp_color = own_color ^ (WHITE | BLACK);
-        const size_t row = GO_MOVE_ROW(move);
-        const size_t col = GO_MOVE_COL(move);
-        assert(row < 24 && col < 32);
-
-        // check if move is in range
-        if (row == 0 || row > size || col == 0 || col > size) {
-            return false;
-        }
-        
-        // check if space is open
-        if (state->board[row][col] != EMPTY) {
+        if (!go_legal(state, move)) {
             return false;
         }
 
-        // (tentatively) place piece
-        state->board[row][col] = own_color;
+        _place_stone(state, GO_POINT(state, move), undo);
 
-        // check for neighbors and neighbor properties
-        go_color neighbor_colors = state->board[row-1][col]
-            | state->board[row+1][col]
-            | state->board[row][col-1]
-            | state->board[row][col+1];
+        // clear passed flag
+        state->passed = 0;
+    }
 
-        bool any_captures = false;
-        if (neighbor_colors & opp_color) {
-            // attempt captures
+    // next player's turn
+    state->turn ^= WHITE | BLACK;
 
-            #define TRYCAP(r,c) \
-                ((state->board[r][c]&opp_color)&&\
-                _try_capture(state,r,c, /*pretend*/ false))
+    return true;
+}
 
-            if TRYCAP(row+1, col) {
-                any_captures = true;
-            }
-            if TRYCAP(row-1, col) {
-                any_captures = true;
-            }
-            if TRYCAP(row, col+1) {
-                any_captures = true;
-            }
-            if TRYCAP(row, col-1) {
-                any_captures = true;
-            }
+//
+// undo log
+//
+// Every field of the state modified by a move is logged as the 16-bit
+// halfword containing it, along with that halfword's old value. Undoing a
+// move restores the logged halfwords in reverse order, followed by the
+// scalar fields saved in the move's frame.
+//
+
+bool go_undo_init(struct go_undo *undo) {
+    undo->num_entries = 0;
+    undo->cap_entries = UNDO_RESERVE;
+    undo->entries = malloc(undo->cap_entries * sizeof(struct go_undo_entry));
+
+    undo->num_frames = 0;
+    undo->cap_frames = 64;
+    undo->frames = malloc(undo->cap_frames * sizeof(struct go_undo_frame));
+
+    if (!undo->entries || !undo->frames) {
+        go_undo_free(undo);
+        return false;
+    }
 
-            #undef TRYCAP
-        }
+    return true;
+}
+
+void go_undo_free(struct go_undo *undo) {
+    free(undo->entries);
+    free(undo->frames);
+    undo->entries = NULL;
+    undo->frames = NULL;
+    undo->num_entries = 0;
+    undo->cap_entries = 0;
+    undo->num_frames = 0;
+    undo->cap_frames = 0;
+}
 
-        if (!any_captures) {
-            // check for suicide
+static inline void _undo_log(struct go_undo *undo, struct go_state *state, void *field) {
+    assert(undo->num_entries < undo->cap_entries);
 
-            if (_try_capture(state, row, col, /*pretend*/ true)) {
+    const size_t offset = ((uint8_t*) field - (uint8_t*) state) & ~(size_t) 1;
+    assert(offset < sizeof(struct go_state));
 
-                // revert placement
-                state->board[row][col] = EMPTY;
-                return false;
-            }
+    struct go_undo_entry *entry = &undo->entries[undo->num_entries];
+    entry->offset = offset;
+    memcpy(&entry->value, (uint8_t*) state + offset, sizeof(entry->value));
+    undo->num_entries++;
+}
+
+bool go_play_undoable(struct go_state *state, go_move move, struct go_undo *undo) {
+    assert(undo);
+
+    // reserve space for the worst case move
+    if (undo->num_entries + UNDO_RESERVE > undo->cap_entries) {
+        const size_t cap_entries = 2 * undo->cap_entries + UNDO_RESERVE;
+        struct go_undo_entry *entries = realloc(undo->entries,
+            cap_entries * sizeof(struct go_undo_entry));
+        if (!entries) {
+            // memory allocation error
+            return false;
         }
-        
-        // update hash
-        state->hash ^= _go_pos_hash[row][col][own_color-1];
 
-        // clear passed flag
-        state->passed = 0;
+        undo->entries = entries;
+        undo->cap_entries = cap_entries;
     }
 
-    // next player's turn
-    state->turn ^= WHITE | BLACK;
+    if (undo->num_frames == undo->cap_frames) {
+        const size_t cap_frames = 2 * undo->cap_frames;
+        struct go_undo_frame *frames = realloc(undo->frames,
+            cap_frames * sizeof(struct go_undo_frame));
+        if (!frames) {
+            // memory allocation error
+            return false;
+        }
+
+        undo->frames = frames;
+        undo->cap_frames = cap_frames;
+    }
+
+    struct go_undo_frame *frame = &undo->frames[undo->num_frames];
+    frame->first_entry = undo->num_entries;
+    frame->hash = state->hash;
+    frame->turn = state->turn;
+    frame->passed = state->passed;
+    frame->scored = state->scored;
+    frame->score = state->score;
+    frame->bcaps = state->bcaps;
+    frame->wcaps = state->wcaps;
+    frame->ko = state->ko;
+
+    if (!_play(state, move, undo)) {
+        // illegal moves leave the state untouched
+        assert(undo->num_entries == frame->first_entry);
+        return false;
+    }
 
+    undo->num_frames++;
     return true;
 }
 
-bool go_legal(struct go_state *state, go_move move) {
+void go_undo(struct go_state *state, struct go_undo *undo) {
+    assert(undo->num_frames > 0);
+
+    undo->num_frames--;
+    const struct go_undo_frame *frame = &undo->frames[undo->num_frames];
+
+    while (undo->num_entries > frame->first_entry) {
+        undo->num_entries--;
+        const struct go_undo_entry *entry = &undo->entries[undo->num_entries];
+        memcpy((uint8_t*) state + entry->offset, &entry->value, sizeof(entry->value));
+    }
+
+    state->hash = frame->hash;
+    state->turn = frame->turn;
+    state->passed = frame->passed;
+    state->scored = frame->scored;
+    state->score = frame->score;
+    state->bcaps = frame->bcaps;
+    state->wcaps = frame->wcaps;
+    state->ko = frame->ko;
+}
+
+bool go_legal(const struct go_state *state, go_move move) {
     const size_t size = state->size;
     assert(size <= 21);
 
@@ -399,10 +805,8 @@ bool go_legal(struct go_state *state, go_move move) {
     }
 
     const go_color own_color = state->turn;
-    const go_color opp_color = own_color ^ (WHITE | BLACK);
     const size_t row = GO_MOVE_ROW(move);
     const size_t col = GO_MOVE_COL(move);
-    assert(row < 24 && col < 32);
 
     // check if move is in range
     if (row == 0 || row > size || col == 0 || col > size) {
@@ -410,100 +814,985 @@ bool go_legal(struct go_state *state, go_move move) {
     }
     
     // check if space is open
-    if (state->board[row][col] != EMPTY) {
+    const go_point point = GO_POINT(state, move);
+    if (state->board[point] != EMPTY) {
         return false;
     }
 
-    // check for neighbors and neighbor properties
-    uint8_t neighbor_colors = state->board[row-1][col]
-        | state->board[row+1][col]
-        | state->board[row][col-1]
-        | state->board[row][col+1];
+    // check for simple ko
+    if (move == state->ko) {
+        return false;
+    }
 
-    // check for isolated point
-    if (neighbor_colors == EMPTY) {
-        return true;
+    // check cached suicide status
+    if (!(state->legal[point] & own_color)) {
+        return false;
     }
 
-    // (tentatively) place piece
-    state->board[row][col] = state->turn;
+    // check for positional superko
+    if (state->history && go_history_contains(state->history, _next_hash(state, point))) {
+        return false;
+    }
 
-    if (neighbor_colors & opp_color) {
-        // attempt captures
+    return true;
+}
 
-        #define TRYCAP(r,c) \
-            ((state->board[r][c]&opp_color)&&\
-            _try_capture(state,r,c, /*pretend*/ true))
+// Computes the position hash after a legal stone placement, including
+// captures, without modifying the state.
+static uint64_t _next_hash(const struct go_state *state, go_point point) {
+    const go_color own_color = state->turn;
+    const go_color opp_color = own_color ^ (WHITE | BLACK);
 
-        if TRYCAP(row+1, col) {
-            state->board[row][col] = EMPTY;
-            return true;
+    uint64_t hash = state->hash ^ _go_pos_hash[point][own_color-1];
+
+    go_point heads[4];
+    const size_t num_heads = _neighbor_strings(state, point, heads);
+    for (size_t i = 0; i < num_heads; i++) {
+        if (state->board[heads[i]] == opp_color && state->libs[heads[i]] == 1) {
+            go_point stone = heads[i];
+            do {
+                hash ^= _go_pos_hash[stone][opp_color-1];
+                stone = state->next[stone];
+            } while (stone != heads[i]);
         }
-        if TRYCAP(row-1, col) {
-            state->board[row][col] = EMPTY;
+    }
+
+    return hash;
+}
+
+//
+// position history for superko
+//
+
+// Hashes are stored in an open-addressed table with linear probing. Zero
+// marks an empty slot, so a zero hash is stored as 1 instead.
+#define HISTORY_KEY(hash) ((hash) ? (hash) : 1)
+
+bool go_history_init(struct go_history *history) {
+    history->count = 0;
+    history->capacity = 256;
+    history->hashes = calloc(history->capacity, sizeof(uint64_t));
+
+    return history->hashes != NULL;
+}
+
+void go_history_free(struct go_history *history) {
+    free(history->hashes);
+    history->hashes = NULL;
+    history->count = 0;
+    history->capacity = 0;
+}
+
+bool go_history_contains(const struct go_history *history, uint64_t hash) {
+    const uint64_t key = HISTORY_KEY(hash);
+    const size_t mask = history->capacity - 1;
+
+    for (size_t i = key & mask; history->hashes[i]; i = (i + 1) & mask) {
+        if (history->hashes[i] == key) {
             return true;
         }
-        if TRYCAP(row, col+1) {
-            state->board[row][col] = EMPTY;
-            return true;
+    }
+
+    return false;
+}
+
+bool go_history_add(struct go_history *history, uint64_t hash) {
+    const uint64_t key = HISTORY_KEY(hash);
+
+    // keep load factor at or below one half
+    if (2 * (history->count + 1) > history->capacity) {
+        const size_t capacity = history->capacity * 2;
+        uint64_t *hashes = calloc(capacity, sizeof(uint64_t));
+        if (!hashes) {
+            // memory allocation error
+            return false;
         }
-        if TRYCAP(row, col-1) {
-            state->board[row][col] = EMPTY;
-            return true;
+
+        for (size_t i = 0; i < history->capacity; i++) {
+            const uint64_t old = history->hashes[i];
+            if (!old) {
+                continue;
+            }
+
+            size_t j = old & (capacity - 1);
+            while (hashes[j]) {
+                j = (j + 1) & (capacity - 1);
+            }
+            hashes[j] = old;
         }
 
-        #undef TRYCAP
+        free(history->hashes);
+        history->hashes = hashes;
+        history->capacity = capacity;
     }
 
-    // check for suicide
-    if (_try_capture(state, row, col, /*pretend*/ true)) {
-        state->board[row][col] = EMPTY;
-        return false;
+    const size_t mask = history->capacity - 1;
+    size_t i = key & mask;
+    while (history->hashes[i]) {
+        if (history->hashes[i] == key) {
+            return true;
+        }
+        i = (i + 1) & mask;
     }
 
-    state->board[row][col] = EMPTY;
+    history->hashes[i] = key;
+    history->count++;
+
     return true;
 }
 
-void go_moves_loose(struct go_state *state, go_move *moves, size_t *count) {
-    const size_t size = state->size;
-    assert(size <= 21);
+void go_moves_loose(const struct go_state *state, go_move *moves, size_t *count) {
+    assert(state->size <= 21);
 
     moves[0] = GO_MOVE_PASS; // pass is always legal
 
-    size_t _count = 1;
-    for (uint8_t r = 1; r <= size; r++) {
-        for (uint8_t c = 1; c <= size; c++) {
-            if (state->board[r][c] == EMPTY) {
-                moves[_count] = GO_MOVE(r, c);
-                _count++;
-            }
-        }
+    for (size_t i = 0; i < state->num_empties; i++) {
+        moves[i+1] = GO_POINT_MOVE(state, state->empties[i]);
     }
 
-    *count = _count;
+    *count = state->num_empties + 1;
 }
 
-void go_moves(struct go_state *state, uint16_t *moves, size_t *count) {
-    const size_t size = state->size;
-    assert(size <= 21);
+void go_moves(const struct go_state *state, go_move *moves, size_t *count) {
+    assert(state->size <= 21);
 
     moves[0] = GO_MOVE_PASS; // pass is always legal
 
+    if (state->scored) {
+        *count = 1;
+        return;
+    }
+
+    const go_color own_color = state->turn;
+
     size_t _count = 1;
-    for (uint8_t r = 1; r <= size; r++) {
-        for (uint8_t c = 1; c <= size; c++) {
-            uint16_t move = GO_MOVE(r, c);
-            if (state->board[r][c] == EMPTY && go_legal(state, move)) {
-                moves[_count] = move;
-                _count++;
+    for (size_t i = 0; i < state->num_empties; i++) {
+        const go_point point = state->empties[i];
+        if (!(state->legal[point] & own_color)) {
+            continue;
+        }
+
+        const go_move move = GO_POINT_MOVE(state, point);
+        if (move == state->ko) {
+            continue;
+        }
+
+        if (state->history && !go_legal(state, move)) {
+            continue;
+        }
+
+        moves[_count] = move;
+        _count++;
+    }
+
+    *count = _count;
+}
+
+//
+// playout move generation
+//
+
+// An empty point is an eye of a color if all of its orthogonal neighbors
+// are that color (or off the board) and the opponent holds fewer than two
+// of its diagonals, or none of them on the edge.
+static inline bool _is_eye(const struct go_state *state, go_point point, go_color color) {
+    const go_color opp_color = color ^ (WHITE | BLACK);
+    const go_pattern pattern = state->pattern[point];
+
+    const size_t orthogonal[4] = {1, 3, 4, 6};
+    for (size_t i = 0; i < 4; i++) {
+        const go_color neighbor = GO_PATTERN_COLOR(pattern, orthogonal[i]);
+        if (neighbor != color && neighbor != OFFBOARD) {
+            return false;
+        }
+    }
+
+    const size_t diagonal[4] = {0, 2, 5, 7};
+    size_t num_opp = 0;
+    bool edge = false;
+    for (size_t i = 0; i < 4; i++) {
+        const go_color neighbor = GO_PATTERN_COLOR(pattern, diagonal[i]);
+        if (neighbor == OFFBOARD) {
+            edge = true;
+        }
+        else if (neighbor == opp_color) {
+            num_opp++;
+        }
+    }
+
+    return num_opp < (edge ? 1 : 2);
+}
+
+bool go_is_eye(const struct go_state *state, go_move move, go_color color) {
+    const go_point point = GO_POINT(state, move);
+    assert(state->size <= 21);
+
+    if (state->board[point] != EMPTY) {
+        return false;
+    }
+
+    return _is_eye(state, point, color);
+}
+
+static inline bool _playout_ok(const struct go_state *state, go_point point) {
+    return !_is_eye(state, point, state->turn) &&
+        go_legal(state, GO_POINT_MOVE(state, point));
+}
+
+go_move go_playout_move(struct go_state *state, struct rng *rng) {
+
+    // The front of the empty point list holds the candidates for this
+    // turn. A rejected candidate is swapped just past the end of them, so
+    // each pick is uniform over the points not yet rejected, and every
+    // point is tried at most once.
+    size_t num_candidates = state->scored ? 0 : state->num_empties;
+    while (num_candidates) {
+        const size_t index = rng_bounded(rng, num_candidates);
+        const go_point point = state->empties[index];
+
+        if (_playout_ok(state, point)) {
+            return GO_POINT_MOVE(state, point);
+        }
+
+        num_candidates--;
+        const go_point last = state->empties[num_candidates];
+        state->empties[index] = last;
+        state->empty_index[last] = index;
+        state->empties[num_candidates] = point;
+        state->empty_index[point] = num_candidates;
+    }
+
+    return GO_MOVE_PASS;
+}
+
+//
+// bitboard implementation
+//
+
+#define BB_WIDTH(size) ((size) + 1)
+#define BB_BIT(size, row, col) (((row) - 1) * BB_WIDTH(size) + ((col) - 1))
+
+static void _bb_init(void) {
+    for (size_t size = 1; size <= 21; size++) {
+        struct go_bitboard *mask = &_bb_on_board[size];
+        struct go_bitboard *edge = &_bb_edge[size];
+        memset(mask, 0, sizeof(struct go_bitboard));
+        memset(edge, 0, sizeof(struct go_bitboard));
+
+        for (size_t row = 1; row <= size; row++) {
+            for (size_t col = 1; col <= size; col++) {
+                const size_t bit = BB_BIT(size, row, col);
+                mask->words[bit / 64] |= (uint64_t) 1 << (bit % 64);
+
+                if (row == 1 || row == size || col == 1 || col == size) {
+                    edge->words[bit / 64] |= (uint64_t) 1 << (bit % 64);
+                }
+            }
+        }
+    }
+}
+
+static inline size_t _bb_words(size_t size) {
+    return (size * BB_WIDTH(size) + 63) / 64;
+}
+
+static inline void _bb_set(struct go_bitboard *bb, size_t bit) {
+    bb->words[bit / 64] |= (uint64_t) 1 << (bit % 64);
+}
+
+static inline void _bb_clear(struct go_bitboard *bb, size_t bit) {
+    bb->words[bit / 64] &= ~((uint64_t) 1 << (bit % 64));
+}
+
+static inline bool _bb_test(const struct go_bitboard *bb, size_t bit) {
+    return (bb->words[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline bool _bb_any(const struct go_bitboard *bb, size_t words) {
+    uint64_t any = 0;
+    for (size_t i = 0; i < words; i++) {
+        any |= bb->words[i];
+    }
+    return any != 0;
+}
+
+static inline size_t _bb_count(const struct go_bitboard *bb, size_t words) {
+    size_t count = 0;
+    for (size_t i = 0; i < words; i++) {
+        count += __builtin_popcountll(bb->words[i]);
+    }
+    return count;
+}
+
+// word i of the board moved shift bits up or down, carrying across words
+static inline uint64_t _bb_up(const struct go_bitboard *bb, size_t i, size_t shift) {
+    return (bb->words[i] << shift) | (i ? bb->words[i-1] >> (64 - shift) : 0);
+}
+
+static inline uint64_t _bb_down(const struct go_bitboard *bb, size_t i, size_t words, size_t shift) {
+    return (bb->words[i] >> shift) | ((i + 1 < words) ? bb->words[i+1] << (64 - shift) : 0);
+}
+
+// The bits of the orthogonal neighbors of a point. Neighbors past the left
+// or right edge are guard bits, which are never set in any board.
+static inline size_t _bb_neighbors(size_t size, size_t bit, size_t *neighbors) {
+    const size_t width = BB_WIDTH(size);
+
+    size_t count = 0;
+    if (bit >= width) {
+        neighbors[count++] = bit - width;
+    }
+    if (bit > 0) {
+        neighbors[count++] = bit - 1;
+    }
+    neighbors[count++] = bit + 1;
+    if (bit + width < size * width) {
+        neighbors[count++] = bit + width;
+    }
+
+    return count;
+}
+
+static inline go_move _bb_move(size_t size, size_t bit) {
+    return GO_MOVE(bit / BB_WIDTH(size) + 1, bit % BB_WIDTH(size) + 1);
+}
+
+// index into the padded board layout of struct go_state, for hashing
+static inline go_point _bb_point(size_t size, size_t bit) {
+    return bit + bit / BB_WIDTH(size) + size + 3;
+}
+
+// The k-th lowest set bit of a word.
+static inline size_t _bb_select(uint64_t word, size_t k) {
+    size_t bit = 0;
+    for (size_t half = 32; half; half /= 2) {
+        const uint64_t low = word & (((uint64_t) 1 << half) - 1);
+        const size_t count = __builtin_popcountll(low);
+        if (k >= count) {
+            k -= count;
+            word >>= half;
+            bit += half;
+        }
+        else {
+            word = low;
+        }
+    }
+    return bit;
+}
+
+// out = (in plus its four neighbors) & mask; out must not alias in
+static inline void _bb_dilate(struct go_bitboard *out, const struct go_bitboard *in,
+                              const struct go_bitboard *mask, size_t words, size_t width) {
+
+    for (size_t i = 0; i < words; i++) {
+        const uint64_t w = in->words[i];
+        const uint64_t prev = i ? in->words[i-1] : 0;
+        const uint64_t next = (i + 1 < words) ? in->words[i+1] : 0;
+
+        uint64_t d = w | (w << 1) | (w >> 1) | (w << width) | (w >> width);
+        d |= prev >> 63;
+        d |= next << 63;
+        d |= prev >> (64 - width);
+        d |= next << (64 - width);
+
+        out->words[i] = d & mask->words[i];
+    }
+}
+
+// Grows seed through connected points of mask until it stops changing.
+static void _bb_flood(struct go_bitboard *region, const struct go_bitboard *seed,
+                      const struct go_bitboard *mask, size_t words, size_t width) {
+
+    struct go_bitboard next;
+    for (size_t i = 0; i < words; i++) {
+        region->words[i] = seed->words[i];
+    }
+
+    while (1) {
+        _bb_dilate(&next, region, mask, words, width);
+
+        uint64_t changed = 0;
+        for (size_t i = 0; i < words; i++) {
+            changed |= next.words[i] ^ region->words[i];
+            region->words[i] = next.words[i];
+        }
+
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+// Tromp-Taylor area count: stones plus the empty points reachable from
+// only one color. The reach of each color is found by dilating its stones
+// through the empty points, a whole row of the board per shift.
+static int16_t _bb_area(const struct go_bitboard *black, const struct go_bitboard *white,
+                        const struct go_bitboard *empty, size_t words, size_t width,
+                        struct go_bitboard *black_area, struct go_bitboard *white_area) {
+
+    // empty points reachable from each color
+    struct go_bitboard seed;
+    struct go_bitboard black_reach;
+    struct go_bitboard white_reach;
+    memset(&seed, 0, sizeof(seed));
+    _bb_dilate(&seed, black, empty, words, width);
+    _bb_flood(&black_reach, &seed, empty, words, width);
+    _bb_dilate(&seed, white, empty, words, width);
+    _bb_flood(&white_reach, &seed, empty, words, width);
+
+    int16_t black_count = 0;
+    int16_t white_count = 0;
+    for (size_t i = 0; i < words; i++) {
+        const uint64_t b = black->words[i] | (black_reach.words[i] & ~white_reach.words[i]);
+        const uint64_t w = white->words[i] | (white_reach.words[i] & ~black_reach.words[i]);
+        black_count += __builtin_popcountll(b);
+        white_count += __builtin_popcountll(w);
+
+        if (black_area) {
+            black_area->words[i] = b;
+            white_area->words[i] = w;
+        }
+    }
+
+    return black_count - white_count;
+}
+
+// Area score of bitboards of a position, filling in owner (by point of a
+// go_state of the same size) if not NULL.
+static int16_t _bb_score(const struct go_bitboard *black, const struct go_bitboard *white,
+                         const struct go_bitboard *empty, size_t size, go_color *owner) {
+    const size_t words = _bb_words(size);
+    const size_t stride = size + 2;
+
+    if (!owner) {
+        return _bb_area(black, white, empty, words, BB_WIDTH(size), NULL, NULL);
+    }
+
+    struct go_bitboard black_area;
+    struct go_bitboard white_area;
+    const int16_t score = _bb_area(black, white, empty, words, BB_WIDTH(size),
+        &black_area, &white_area);
+
+    for (size_t row = 1; row <= size; row++) {
+        size_t bit = BB_BIT(size, row, 1);
+
+        for (size_t col = 1; col <= size; col++, bit++) {
+            go_color color = EMPTY;
+            if (_bb_test(&black_area, bit)) {
+                color = BLACK;
+            }
+            else if (_bb_test(&white_area, bit)) {
+                color = WHITE;
+            }
+            owner[row * stride + col] = color;
+        }
+    }
+
+    return score;
+}
+
+int16_t go_score(const struct go_state *state, go_color *owner) {
+    const size_t size = state->size;
+    const size_t stride = state->stride;
+    assert(size >= 1 && size <= 21);
+
+    struct go_bitboard black;
+    struct go_bitboard white;
+    struct go_bitboard empty;
+    memset(&black, 0, sizeof(black));
+    memset(&white, 0, sizeof(white));
+    memset(&empty, 0, sizeof(empty));
+
+    for (size_t row = 1; row <= size; row++) {
+        const go_color *line = &state->board[row * stride];
+        size_t bit = BB_BIT(size, row, 1);
+
+        for (size_t col = 1; col <= size; col++, bit++) {
+            switch (line[col]) {
+            case BLACK: _bb_set(&black, bit); break;
+            case WHITE: _bb_set(&white, bit); break;
+            default:    _bb_set(&empty, bit); break;
+            }
+        }
+    }
+
+    return _bb_score(&black, &white, &empty, size, owner);
+}
+
+int16_t go_bitstate_score(const struct go_bitstate *state, go_color *owner) {
+    return _bb_score(&state->black, &state->white, &state->empty, state->size, owner);
+}
+
+void go_bitstate_setup(struct go_bitstate *state, size_t size, size_t hcap, go_move *hcaps) {
+    assert(size >= 1 && size <= 21);
+
+    memset(state, 0, sizeof(struct go_bitstate));
+    state->size = size;
+    state->stride = size + 2;
+    state->words = _bb_words(size);
+    state->turn = (hcap == 0) ? BLACK : WHITE;
+    state->empty = _bb_on_board[size];
+
+    if (hcap) {
+        assert(hcaps != NULL);
+    }
+
+    for (size_t i = 0; i < hcap; i++) {
+        const uint8_t row = GO_MOVE_ROW(hcaps[i]);
+        const uint8_t col = GO_MOVE_COL(hcaps[i]);
+        assert(row > 0 && row <= size && col > 0 && col <= size);
+
+        const size_t bit = BB_BIT(size, row, col);
+        assert(_bb_test(&state->empty, bit));
+
+        _bb_set(&state->black, bit);
+        _bb_clear(&state->empty, bit);
+        state->hash ^= _go_pos_hash[_bb_point(size, bit)][0];
+    }
+}
+
+void go_bitstate_from_state(struct go_bitstate *state, const struct go_state *source) {
+    const size_t size = source->size;
+    assert(size >= 1 && size <= 21);
+
+    memset(state, 0, sizeof(struct go_bitstate));
+    state->size = size;
+    state->stride = source->stride;
+    state->words = _bb_words(size);
+    state->hash = source->hash;
+    state->history = source->history;
+    state->turn = source->turn;
+    state->passed = source->passed;
+    state->scored = source->scored;
+    state->score = source->score;
+    state->bcaps = source->bcaps;
+    state->wcaps = source->wcaps;
+    state->ko = source->ko;
+
+    for (size_t row = 1; row <= size; row++) {
+        const go_color *line = &source->board[row * source->stride];
+        size_t bit = BB_BIT(size, row, 1);
+
+        for (size_t col = 1; col <= size; col++, bit++) {
+            switch (line[col]) {
+            case BLACK: _bb_set(&state->black, bit); break;
+            case WHITE: _bb_set(&state->white, bit); break;
+            default:    _bb_set(&state->empty, bit); break;
+            }
+        }
+    }
+}
+
+go_color go_bitstate_color(const struct go_bitstate *state, go_move move) {
+    const size_t row = GO_MOVE_ROW(move);
+    const size_t col = GO_MOVE_COL(move);
+    assert(row >= 1 && row <= state->size && col >= 1 && col <= state->size);
+
+    const size_t bit = BB_BIT(state->size, row, col);
+    if (_bb_test(&state->black, bit)) {
+        return BLACK;
+    }
+    if (_bb_test(&state->white, bit)) {
+        return WHITE;
+    }
+    return EMPTY;
+}
+
+// Whether a stone has an empty neighbor other than the excluded bit.
+static inline bool _bb_other_liberty(const struct go_bitstate *state, size_t stone, size_t exclude) {
+    size_t neighbors[4];
+    const size_t num_neighbors = _bb_neighbors(state->size, stone, neighbors);
+    for (size_t i = 0; i < num_neighbors; i++) {
+        if (neighbors[i] != exclude && _bb_test(&state->empty, neighbors[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the string of a stone of the given color has a liberty other
+// than the excluded bit. The string is grown in place, a word at a time,
+// and the search stops at the first such liberty, so only strings really
+// down to the excluded liberty are flooded whole, into string.
+static bool _bb_string_liberty(const struct go_bitstate *state, const struct go_bitboard *color,
+                               size_t stone, size_t exclude, struct go_bitboard *string) {
+    const size_t words = state->words;
+    const size_t width = BB_WIDTH(state->size);
+
+    if (_bb_other_liberty(state, stone, exclude)) {
+        return true;
+    }
+
+    struct go_bitboard libs = state->empty;
+    _bb_clear(&libs, exclude);
+
+    memset(string, 0, sizeof(struct go_bitboard));
+    _bb_set(string, stone);
+
+    // a step reaches at most one word past the words holding the string
+    size_t first = stone / 64;
+    size_t last = stone / 64;
+    while (1) {
+        const size_t from = first ? first - 1 : 0;
+        const size_t to = (last + 1 < words) ? last + 1 : last;
+
+        uint64_t changed = 0;
+        for (size_t i = from; i <= to; i++) {
+            const uint64_t grown = string->words[i] |
+                _bb_up(string, i, 1) | _bb_down(string, i, words, 1) |
+                _bb_up(string, i, width) | _bb_down(string, i, words, width);
+
+            if (grown & libs.words[i]) {
+                return true;
+            }
+
+            const uint64_t stones = grown & color->words[i];
+            changed |= stones ^ string->words[i];
+            string->words[i] = stones;
+        }
+
+        if (!changed) {
+            return false;
+        }
+
+        while (first > from && string->words[first-1]) {
+            first--;
+        }
+        while (last < to && string->words[last+1]) {
+            last++;
+        }
+    }
+}
+
+// Checks a stone placement on an empty point without modifying the state;
+// on success, fills in the opposing stones it captures.
+static bool _bb_try_place(const struct go_bitstate *state, size_t bit, struct go_bitboard *captured) {
+    const struct go_bitboard *own = (state->turn == BLACK) ? &state->black : &state->white;
+    const struct go_bitboard *opp = (state->turn == BLACK) ? &state->white : &state->black;
+
+    size_t neighbors[4];
+    const size_t num_neighbors = _bb_neighbors(state->size, bit, neighbors);
+
+    memset(captured, 0, sizeof(struct go_bitboard));
+
+    // find adjacent opposing strings whose only liberty is this point
+    bool has_liberty = false;
+    bool any_captures = false;
+    for (size_t i = 0; i < num_neighbors; i++) {
+        const size_t n = neighbors[i];
+        if (_bb_test(&state->empty, n)) {
+            has_liberty = true;
+        }
+        else if (_bb_test(opp, n) && !_bb_test(captured, n)) {
+            struct go_bitboard string;
+            if (!_bb_string_liberty(state, opp, n, bit, &string)) {
+                for (size_t j = 0; j < state->words; j++) {
+                    captured->words[j] |= string.words[j];
+                }
+                any_captures = true;
+            }
+        }
+    }
+
+    if (has_liberty || any_captures) {
+        return true;
+    }
+
+    // check for suicide: an adjacent own string needs a liberty elsewhere
+    for (size_t i = 0; i < num_neighbors; i++) {
+        struct go_bitboard string;
+        if (_bb_test(own, neighbors[i]) &&
+            _bb_string_liberty(state, own, neighbors[i], bit, &string)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Position hash after placing a stone and removing the captured stones.
+static uint64_t _bb_next_hash(const struct go_bitstate *state, size_t bit,
+                              const struct go_bitboard *captured) {
+    const size_t size = state->size;
+    const go_color own_color = state->turn;
+    const go_color opp_color = own_color ^ (WHITE | BLACK);
+
+    uint64_t hash = state->hash ^ _go_pos_hash[_bb_point(size, bit)][own_color-1];
+    for (size_t i = 0; i < state->words; i++) {
+        uint64_t w = captured->words[i];
+        while (w) {
+            hash ^= _go_pos_hash[_bb_point(size, i * 64 + __builtin_ctzll(w))][opp_color-1];
+            w &= w - 1;
+        }
+    }
+
+    return hash;
+}
+
+// Legality of a stone placement on an empty point other than the ko point.
+static inline bool _bb_legal_at(const struct go_bitstate *state, size_t bit,
+                                struct go_bitboard *captured) {
+    if (!_bb_try_place(state, bit, captured)) {
+        return false;
+    }
+
+    if (state->history &&
+        go_history_contains(state->history, _bb_next_hash(state, bit, captured))) {
+        return false;
+    }
+
+    return true;
+}
+
+bool go_bitstate_legal(const struct go_bitstate *state, go_move move) {
+    const size_t size = state->size;
+
+    if (state->scored) {
+        return false;
+    }
+
+    if (!move) {
+        return true;
+    }
+
+    const size_t row = GO_MOVE_ROW(move);
+    const size_t col = GO_MOVE_COL(move);
+    if (row == 0 || row > size || col == 0 || col > size) {
+        return false;
+    }
+
+    const size_t bit = BB_BIT(size, row, col);
+    if (!_bb_test(&state->empty, bit)) {
+        return false;
+    }
+
+    if (move == state->ko) {
+        return false;
+    }
+
+    struct go_bitboard captured;
+    return _bb_legal_at(state, bit, &captured);
+}
+
+// Places a stone for the side to move on a point checked by _bb_legal_at,
+// removing the stones it captures, and passes the turn.
+static void _bb_place(struct go_bitstate *state, size_t bit, const struct go_bitboard *captured) {
+    const size_t size = state->size;
+    const size_t words = state->words;
+
+    const go_color own_color = state->turn;
+    const go_color opp_color = own_color ^ (WHITE | BLACK);
+    struct go_bitboard *own = (own_color == BLACK) ? &state->black : &state->white;
+    struct go_bitboard *opp = (own_color == BLACK) ? &state->white : &state->black;
+
+    state->hash = _bb_next_hash(state, bit, captured);
+    _bb_set(own, bit);
+    _bb_clear(&state->empty, bit);
+
+    size_t count = 0;
+    for (size_t i = 0; i < words; i++) {
+        opp->words[i] &= ~captured->words[i];
+        state->empty.words[i] |= captured->words[i];
+        count += __builtin_popcountll(captured->words[i]);
+    }
+
+    if (opp_color == BLACK) {
+        state->bcaps += count;
+    }
+    else {
+        state->wcaps += count;
+    }
+
+    // check for simple ko: a lone stone captured a lone stone and its
+    // only liberty is the captured point
+    state->ko = GO_MOVE_PASS;
+    if (count == 1) {
+        size_t neighbors[4];
+        const size_t num_neighbors = _bb_neighbors(size, bit, neighbors);
+
+        bool lone = true;
+        size_t ko = 0;
+        for (size_t i = 0; i < num_neighbors; i++) {
+            const size_t n = neighbors[i];
+            if (_bb_test(captured, n)) {
+                ko = n;
+            }
+            else if (_bb_test(own, n) || _bb_test(&state->empty, n)) {
+                lone = false;
             }
         }
+
+        if (lone) {
+            state->ko = _bb_move(size, ko);
+        }
+    }
+
+    state->passed = 0;
+    state->turn = opp_color;
+}
+
+bool go_bitstate_play(struct go_bitstate *state, go_move move) {
+    const size_t size = state->size;
+
+    if (state->scored) {
+        return false;
+    }
+
+    if (!move) {
+        if (state->passed) {
+            // game over, score
+            state->score = go_bitstate_score(state, NULL);
+            state->scored = 1;
+        }
+        else {
+            state->passed = 1;
+        }
+
+        state->ko = GO_MOVE_PASS;
+        state->turn ^= WHITE | BLACK;
+        return true;
+    }
+
+    const size_t row = GO_MOVE_ROW(move);
+    const size_t col = GO_MOVE_COL(move);
+    if (row == 0 || row > size || col == 0 || col > size) {
+        return false;
+    }
+
+    const size_t bit = BB_BIT(size, row, col);
+    if (!_bb_test(&state->empty, bit)) {
+        return false;
+    }
+
+    if (move == state->ko) {
+        return false;
+    }
+
+    struct go_bitboard captured;
+    if (!_bb_legal_at(state, bit, &captured)) {
+        return false;
+    }
+
+    _bb_place(state, bit, &captured);
+
+    return true;
+}
+
+void go_bitstate_moves_loose(const struct go_bitstate *state, go_move *moves, size_t *count) {
+    const size_t size = state->size;
+
+    moves[0] = GO_MOVE_PASS; // pass is always legal
+
+    size_t _count = 1;
+    for (size_t i = 0; i < state->words; i++) {
+        uint64_t w = state->empty.words[i];
+        while (w) {
+            moves[_count] = _bb_move(size, i * 64 + __builtin_ctzll(w));
+            _count++;
+            w &= w - 1;
+        }
     }
 
     *count = _count;
 }
 
+// Empty points that are eyes of the side to move by the rule of _is_eye,
+// for all points at once: none of the four neighbors is empty or the
+// opponent's, and the opponent holds fewer than two diagonals, or none on
+// the edge. Diagonals past the left or right edge land on guard bits.
+static void _bb_eyes(const struct go_bitstate *state, struct go_bitboard *eyes) {
+    const size_t words = state->words;
+    const size_t width = BB_WIDTH(state->size);
+    const struct go_bitboard *opp = (state->turn == BLACK) ? &state->white : &state->black;
+    const struct go_bitboard *edge = &_bb_edge[state->size];
+
+    struct go_bitboard open;
+    for (size_t i = 0; i < words; i++) {
+        open.words[i] = state->empty.words[i] | opp->words[i];
+    }
+
+    for (size_t i = 0; i < words; i++) {
+        const uint64_t blocked = _bb_up(&open, i, 1) | _bb_down(&open, i, words, 1) |
+            _bb_up(&open, i, width) | _bb_down(&open, i, words, width);
+
+        const uint64_t a = _bb_up(opp, i, width - 1);
+        const uint64_t b = _bb_up(opp, i, width + 1);
+        const uint64_t c = _bb_down(opp, i, words, width - 1);
+        const uint64_t d = _bb_down(opp, i, words, width + 1);
+        const uint64_t one = a | b | c | d;
+        const uint64_t two = (a & b) | (c & d) | ((a | b) & (c | d));
+
+        eyes->words[i] = state->empty.words[i] & ~blocked & ~two & ~(one & edge->words[i]);
+    }
+}
+
+// Finds the point of a playout move, with the stones it captures, or
+// returns false if the side to move should pass.
+static bool _bb_playout_point(const struct go_bitstate *state, struct rng *rng,
+                              size_t *point, struct go_bitboard *captured) {
+    const size_t size = state->size;
+    const size_t words = state->words;
+
+    if (state->scored) {
+        return false;
+    }
+
+    // every empty point that isn't an eye or the ko point is a candidate;
+    // picks are uniform over the candidates not yet rejected
+    struct go_bitboard candidates;
+    _bb_eyes(state, &candidates);
+    for (size_t i = 0; i < words; i++) {
+        candidates.words[i] = state->empty.words[i] & ~candidates.words[i];
+    }
+
+    if (state->ko) {
+        _bb_clear(&candidates, BB_BIT(size, GO_MOVE_ROW(state->ko), GO_MOVE_COL(state->ko)));
+    }
+
+    size_t num_candidates = _bb_count(&candidates, words);
+    while (num_candidates) {
+        size_t k = rng_bounded(rng, num_candidates);
+        size_t i = 0;
+        while (k >= (size_t) __builtin_popcountll(candidates.words[i])) {
+            k -= __builtin_popcountll(candidates.words[i]);
+            i++;
+        }
+
+        const size_t bit = i * 64 + _bb_select(candidates.words[i], k);
+        if (_bb_legal_at(state, bit, captured)) {
+            *point = bit;
+            return true;
+        }
+
+        _bb_clear(&candidates, bit);
+        num_candidates--;
+    }
+
+    return false;
+}
+
+go_move go_bitstate_playout_move(const struct go_bitstate *state, struct rng *rng) {
+    size_t bit;
+    struct go_bitboard captured;
+    if (!_bb_playout_point(state, rng, &bit, &captured)) {
+        return GO_MOVE_PASS;
+    }
+
+    return _bb_move(state->size, bit);
+}
+
+go_move go_bitstate_play_playout(struct go_bitstate *state, struct rng *rng) {
+    size_t bit;
+    struct go_bitboard captured;
+    if (!_bb_playout_point(state, rng, &bit, &captured)) {
+        go_bitstate_play(state, GO_MOVE_PASS);
+        return GO_MOVE_PASS;
+    }
+
+    _bb_place(state, bit, &captured);
+    return _bb_move(state->size, bit);
+}
+
 void go_print(struct go_state *state, FILE *stream) {
     
     // so beautiful...
@@ -523,13 +1812,14 @@ void go_print(struct go_state *state, FILE *stream) {
     for (size_t r = 1; r <= state->size; r++) {
         fputs("\xe2\x95\x91  ", stream);
         for (size_t c = 1; c <= state->size; c++) {
-            if (state->board[r][c] == EMPTY) {
+            const go_color color = state->board[r * state->stride + c];
+            if (color == EMPTY) {
                 fputs("\xc2\xb7 ", stream);
             }
-            else if (state->board[r][c] == BLACK) {
+            else if (color == BLACK) {
                 fputs("\xe2\xac\xa4 ", stream);
             }
-            else if (state->board[r][c] == WHITE) {
+            else if (color == WHITE) {
                 fputs("\xe2\x97\xaf ", stream);
             }
         }
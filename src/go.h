@@ -7,6 +7,8 @@
 #include <stddef.h>
 #include <stdio.h>
 
+struct rng;
+
 bool go_init(void);
 
 //
@@ -15,26 +17,88 @@ bool go_init(void);
 
 typedef uint8_t go_color;
 
-#define GO_COLOR_EMPTY 0
-#define GO_COLOR_BLACK 1
-#define GO_COLOR_WHITE 2
+#define GO_COLOR_EMPTY    0
+#define GO_COLOR_BLACK    1
+#define GO_COLOR_WHITE    2
+#define GO_COLOR_OFFBOARD 3 // sentinel surrounding the board
+
+// The board is stored as a linear array of (size+2)^2 points, with a
+// sentinel border of GO_COLOR_OFFBOARD around the playing area, so the
+// neighbors of point p are p-1, p+1, p-stride and p+stride, and no
+// neighbor access needs a range check.
+
+typedef uint16_t go_point; // index into the padded board
+
+// 3x3 neighborhood code: bits 2i and 2i+1 hold the color of the i-th
+// surrounding point in row-major order (NW, N, NE, W, E, SW, S, SE), and
+// bit 16+j is set if the j-th orthogonal neighbor (N, W, E, S) is a stone
+// in atari. Codes are below 2^20, so they index a lookup table directly.
+typedef uint32_t go_pattern;
+
+#define GO_PATTERN_BITS 20
+#define GO_PATTERN_COLOR(pattern, i) (((pattern) >> (2 * (i))) & 3)
+#define GO_PATTERN_ATARI(pattern, j) (((pattern) >> (16 + (j))) & 1)
+
+#define GO_MAX_STRIDE 23
+#define GO_MAX_POINTS (GO_MAX_STRIDE * GO_MAX_STRIDE)
+#define GO_MAX_EMPTIES (21 * 21)
 
 struct go_state {
-    go_color board[24][32];
 
+    // fields touched on every move come first
     uint64_t hash;
 
     uint8_t  size; // max 21, to limit valid positions to 512
+    uint8_t  stride; // size + 2
     uint8_t  turn;
     uint8_t  passed;
     uint8_t  scored;
     int16_t  score; // raw score before komi
     uint16_t bcaps; // black stones captured, not stones captured _by_ black
     uint16_t wcaps; // ditto
+    uint16_t ko;    // move forbidden by simple ko, or GO_MOVE_PASS
+
+    // optional positional superko history (see below), NULL to disable
+    struct go_history *history;
+
+    // optional change list (see below), NULL to disable
+    struct go_changes *changes;
+
+    go_color board[GO_MAX_POINTS];
+
+    // string tracking: each stone points to the head stone of its string
+    // and to the next stone in a circular list of the string's stones;
+    // liberty and stone counts are kept at the head, and stop at 255 (which
+    // then means 255 or more)
+    go_point string[GO_MAX_POINTS];
+    go_point next[GO_MAX_POINTS];
+    uint8_t  libs[GO_MAX_POINTS];
+    uint8_t  stones[GO_MAX_POINTS];
+
+    // unordered list of empty points, with each point's index in the list
+    uint16_t num_empties;
+    go_point empties[GO_MAX_EMPTIES];
+    uint16_t empty_index[GO_MAX_POINTS];
+
+    // for each empty point, the colors (as a bitmask) that can play there
+    // without suicide in the low two bits, and the atari bits of its 3x3
+    // code in the high four; ko and superko are checked separately
+    uint8_t  legal[GO_MAX_POINTS];
+
+    // for each empty point, the color bits of its 3x3 code
+    uint16_t pattern[GO_MAX_POINTS];
 };
 
-#define go_copy(s, out) (memcpy(s, out, sizeof(struct go_state)))
-#define go_equal(s0, s1) (!memcmp(s0, s1, sizeof(struct go_state)))
+// the 3x3 code of an empty point, put together from the two caches above
+#define GO_PATTERN_AT(state, point) \
+    ((go_pattern) (state)->pattern[point] | (go_pattern) ((state)->legal[point] >> 4) << 16)
+
+// Copies and compares only what a board of the state's size uses: the
+// fields before the board, the first stride^2 points of each per point
+// array, and the empty points listed. The rest of a copy may be left as it
+// was, so states must not be compared with memcmp.
+void go_copy(const struct go_state *state, struct go_state *out);
+bool go_equal(const struct go_state *s0, const struct go_state *s1);
 
 //
 // move representation
@@ -47,16 +111,181 @@ typedef uint16_t go_move; // move in matrix coordinates, 1-indexed
 #define GO_MOVE_ROW(move) ((move) >> 8)
 #define GO_MOVE_COL(move) ((move) & 0xFF)
 
+// conversion between moves and points of a given state
+#define GO_POINT(state, move) \
+    (GO_MOVE_ROW(move) * (state)->stride + GO_MOVE_COL(move))
+#define GO_POINT_MOVE(state, point) \
+    GO_MOVE((point) / (state)->stride, (point) % (state)->stride)
+
 //
 // rules implementation
 //
 
 void go_setup(struct go_state *state, size_t size, size_t hcap, go_move *hcaps);
 bool go_play(struct go_state *state, go_move move);
-bool go_legal(struct go_state *state, go_move move);
-void go_moves(struct go_state *state, go_move *moves, size_t *count);
-void go_moves_loose(struct go_state *state, go_move *moves, size_t *count);
+bool go_legal(const struct go_state *state, go_move move);
+
+// Tromp-Taylor score (black minus white, before komi) of the current
+// position, without modifying it. If owner is not NULL, it is indexed by
+// point like the board and receives BLACK, WHITE or EMPTY (neutral) for
+// every point on the board.
+int16_t go_score(const struct go_state *state, go_color *owner);
+
+// Both write GO_MOVE_PASS first, followed by the other moves in no
+// particular order. go_moves_loose lists every empty point.
+void go_moves(const struct go_state *state, go_move *moves, size_t *count);
+void go_moves_loose(const struct go_state *state, go_move *moves, size_t *count);
+
+// Whether an empty point is a single-point true eye of the given color.
+bool go_is_eye(const struct go_state *state, go_move move, go_color color);
+
+// Picks a uniformly random legal move for a playout, excluding eyes of the
+// side to move. Passes only if there is no such move. Reorders the empty
+// point list of the state, which is not recorded by the undo log.
+go_move go_playout_move(struct go_state *state, struct rng *rng);
 
 void go_print(struct go_state *state, FILE *stream);
 
+//
+// undo log
+//
+// go_play_undoable plays a move like go_play and records enough to revert
+// it; go_undo reverts the most recent recorded move. Moves nest, so a
+// search can descend several moves with one log and unwind them in
+// reverse order instead of copying the state.
+//
+
+struct go_undo_entry {
+    uint16_t offset; // byte offset of a 16-bit halfword in go_state
+    uint16_t value;  // its value before modification
+};
+
+struct go_undo_frame {
+    size_t first_entry;
+
+    uint64_t hash;
+    uint8_t  turn;
+    uint8_t  passed;
+    uint8_t  scored;
+    int16_t  score;
+    uint16_t bcaps;
+    uint16_t wcaps;
+    uint16_t ko;
+};
+
+struct go_undo {
+    size_t num_entries;
+    size_t cap_entries;
+    struct go_undo_entry *entries;
+
+    size_t num_frames;
+    size_t cap_frames;
+    struct go_undo_frame *frames;
+};
+
+bool go_undo_init(struct go_undo *undo);
+void go_undo_free(struct go_undo *undo);
+bool go_play_undoable(struct go_state *state, go_move move, struct go_undo *undo);
+void go_undo(struct go_state *state, struct go_undo *undo);
+
+//
+// change tracking
+//
+// When go_state.changes is set, every point that becomes occupied or empty,
+// or whose cached legality bits or pattern code change, is appended to it
+// (possibly more than once). This lets incremental consumers such as
+// playout policies update only what moved. The consumer resets count and
+// overflow; on overflow, everything must be treated as changed.
+//
+
+#define GO_MAX_CHANGES GO_MAX_POINTS
+
+struct go_changes {
+    size_t count;
+    bool overflow;
+    go_point points[GO_MAX_CHANGES];
+};
+
+//
+// position history
+//
+// When go_state.history is set, go_legal also rejects moves that recreate
+// any position recorded in the history (positional superko). Positions are
+// added explicitly with go_history_add, normally once per move actually
+// played in a game, so states copied for search and playouts can share a
+// history without modifying it.
+//
+
+struct go_history {
+    size_t count;
+    size_t capacity; // power of two
+    uint64_t *hashes;
+};
+
+bool go_history_init(struct go_history *history);
+void go_history_free(struct go_history *history);
+bool go_history_add(struct go_history *history, uint64_t hash);
+bool go_history_contains(const struct go_history *history, uint64_t hash);
+
+//
+// bitboard representation
+//
+// A compact alternative to struct go_state for copy-heavy code such as
+// playouts, which go_score also uses to count territory. Each point
+// (row, col) maps to bit (row-1) * (size+1) + (col-1), so every row is
+// followed by one always-clear guard bit that keeps horizontal shifts from
+// wrapping between rows. Only the first `words` words are used: 2 for 9x9,
+// 6 for 19x19, 8 for 21x21.
+//
+// No strings or liberties are cached: a move settles captures and suicide
+// from the colors around its point, and only floods a neighboring string
+// whose stone next to the point has no other liberty.
+//
+
+#define GO_BITBOARD_WORDS 8
+
+struct go_bitboard {
+    uint64_t words[GO_BITBOARD_WORDS];
+};
+
+struct go_bitstate {
+    struct go_bitboard black;
+    struct go_bitboard white;
+    struct go_bitboard empty;
+
+    uint64_t hash; // same as the go_state of the position
+
+    // optional positional superko history, as for struct go_state
+    struct go_history *history;
+
+    uint8_t  size;
+    uint8_t  stride; // of the go_state of the position, for GO_POINT
+    uint8_t  words;  // number of words in use
+    uint8_t  turn;
+    uint8_t  passed;
+    uint8_t  scored;
+    int16_t  score; // raw score before komi
+    uint16_t bcaps;
+    uint16_t wcaps;
+    uint16_t ko;    // move forbidden by simple ko, or GO_MOVE_PASS
+};
+
+void go_bitstate_setup(struct go_bitstate *state, size_t size, size_t hcap, go_move *hcaps);
+void go_bitstate_from_state(struct go_bitstate *state, const struct go_state *source);
+bool go_bitstate_play(struct go_bitstate *state, go_move move);
+bool go_bitstate_legal(const struct go_bitstate *state, go_move move);
+void go_bitstate_moves_loose(const struct go_bitstate *state, go_move *moves, size_t *count);
+go_color go_bitstate_color(const struct go_bitstate *state, go_move move);
+
+// Picks a playout move as go_playout_move does for the same position.
+go_move go_bitstate_playout_move(const struct go_bitstate *state, struct rng *rng);
+
+// Plays the move go_bitstate_playout_move would pick and returns it,
+// without checking it a second time.
+go_move go_bitstate_play_playout(struct go_bitstate *state, struct rng *rng);
+
+// Area score as go_score computes it, with owner indexed by the points of
+// a go_state of the same size.
+int16_t go_bitstate_score(const struct go_bitstate *state, go_color *owner);
+
 #endif//KERPLUNK_GO_H_
@@ -8,7 +8,7 @@
 #include "assert.h"
 #include "gtree.h"
 
-static struct gtree_node *_create_root_node(struct gtree *tree, const struct go_state *state_);
+static struct gtree_node *_create_root_node(struct gtree *tree, const struct go_state *state);
 static struct gtree_node *_create_node(struct gtree_node *parent, go_move move);
 static bool _delete_subtree(struct gtree_node *node);
 
@@ -105,8 +105,13 @@ bool gtree_setup(struct gtree *tree, const struct go_state *state, const struct
     tree->reldepth = 0;
     tree->maxdepth = 0;
 
+    if (!go_undo_init(&tree->undo)) {
+        return false;
+    }
+
     tree->root = _create_root_node(tree, state);
     if (!tree->root) {
+        go_undo_free(&tree->undo);
         return false;
     }
 
@@ -119,24 +124,23 @@ void gtree_free(struct gtree *gtree) {
     if (gtree->root) {
         _delete_subtree(gtree->root);
     }
+
+    go_undo_free(&gtree->undo);
 }
 
 //
 // node operations
 //
 
-static struct gtree_node *_create_root_node(struct gtree *tree, const struct go_state *state_) {
+static struct gtree_node *_create_root_node(struct gtree *tree, const struct go_state *state) {
     assert(tree);
     assert(tree->schema);
 
     const struct gtree_schema *schema = tree->schema;
 
-    struct go_state state;
-    go_copy(&state, &state_);
-
     go_move moves[512];
     size_t num_moves;
-    go_moves(&state, moves, &num_moves);
+    go_moves(state, moves, &num_moves);
 
     size_t size = sizeof(struct gtree_node) +
         schema->size_base +
@@ -148,7 +152,7 @@ static struct gtree_node *_create_root_node(struct gtree *tree, const struct go_
         return NULL;
     }
 
-    go_copy(&state, &node->state);
+    go_copy(state, &node->state);
     node->reldepth = 0;
     node->tree = tree;
     node->parent = NULL;
@@ -190,17 +194,18 @@ static struct gtree_node *_create_node(struct gtree_node *parent, go_move move)
     assert(parent->tree->schema);
 
     const struct gtree_schema *schema = parent->tree->schema;
+    struct go_undo *undo = &parent->tree->undo;
 
-    struct go_state state;
-    go_copy(&state, &parent->state);
-    if (!go_play(&state, move)) {
+    // derive the child position in place; the parent is restored below
+    struct go_state *state = &parent->state;
+    if (!go_play_undoable(state, move, undo)) {
         // illegal move
         return NULL;
     }
 
     go_move moves[512];
     size_t num_moves;
-    go_moves(&state, moves, &num_moves);
+    go_moves(state, moves, &num_moves);
 
     size_t size = sizeof(struct gtree_node) + 
         schema->size_base + 
@@ -209,10 +214,12 @@ static struct gtree_node *_create_node(struct gtree_node *parent, go_move move)
     struct gtree_node *node = malloc(size);
     if (!node) {
         // memory allocation error
+        go_undo(state, undo);
         return NULL;
     }
 
-    go_copy(&state, &node->state);
+    go_copy(state, &node->state);
+    go_undo(state, undo);
     node->reldepth = parent->reldepth + 1;
     node->tree = parent->tree;
     node->parent = parent;
@@ -73,6 +73,8 @@ struct gtree {
     struct gtree_node *root;
     size_t reldepth;
     size_t maxdepth;
+
+    struct go_undo undo; // for deriving child positions in place
 };
 
 // schema operations
@@ -13,24 +13,41 @@
 #include <lauxlib.h>
 
 #include "go.h"
+#include "rng.h"
 
 const char *cmds[] = {
     "cat",
     "import_games",
     "extract_features",
+    "bench",
     NULL
 };
 
 int main(int argc, char **argv) {
-    srand(clock());
     if (sodium_init() == -1) {
         perror("failure to initialize libsodium");
         return -1;
     }
     go_init();
 
+    // random seed, from the command line for reproducible runs
+    uint64_t seed = (uint64_t) time(NULL) ^ ((uint64_t) clock() << 32);
+    if (argc >= 3 && !strcmp(argv[1], "--seed")) {
+        char *end;
+        seed = strtoull(argv[2], &end, 0);
+        if (*end != '\0') {
+            fprintf(stderr, "invalid seed %s\n", argv[2]);
+            return -1;
+        }
+
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    rng_set_seed(seed);
+
     if (argc < 2) {
-        fprintf(stderr, "Usage: kerplunk <cmd> ...\n");
+        fprintf(stderr, "Usage: kerplunk [--seed <n>] <cmd> ...\n");
         return -1;
     }
 
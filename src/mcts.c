@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 1
+#define _POSIX_C_SOURCE 200112L
 
 #include <stdlib.h>
 #include <string.h>
@@ -6,50 +6,781 @@
 #include <assert.h>
 #include <stdio.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "mcts.h"
+#include "pool.h"
+#include "arena.h"
+#include "batch.h"
 
-void mc_run_random_playout(struct go_state *state) {
-    unsigned int rand_state = rand();
+int16_t mc_run_random_playout(struct go_state *state, struct rng *rng,
+                              struct mc_amaf *amaf, struct mc_stats *stats) {
 
-    while (!state->scored) {
-        uint16_t all_moves[512];
-        size_t num_moves;
-        go_moves_loose(state, all_moves, &num_moves);
+    const size_t max_moves = MC_MAX_MOVES(state->size);
+    size_t num_moves = 0;
+    while (!state->scored && num_moves < max_moves) {
+        const go_move move = go_playout_move(state, rng);
+        mc_amaf_play(amaf, state, move);
+        go_play(state, move);
+        num_moves++;
+    }
 
-        uint16_t move;
-        do {
-            move = all_moves[rand_r(&rand_state) % num_moves];
-        } while (!go_legal(state, move));
+    if (stats) {
+        stats->num_playouts++;
+        stats->num_moves += num_moves;
+        if (!state->scored) {
+            stats->num_capped++;
+        }
+    }
 
-        go_play(state, move);
+    if (!state->scored) {
+        return go_score(state, NULL);
     }
+
+    return state->score;
 }
 
-struct mcts_tree *mcts_new(struct go_state *state) {
-    size_t num_moves;
-    uint16_t moves[512];
-    go_moves(state, moves, &num_moves);
+int16_t mc_run_bitstate_playout(struct go_bitstate *state, struct rng *rng,
+                                struct mc_amaf *amaf, struct mc_stats *stats) {
+
+    const size_t max_moves = MC_MAX_MOVES(state->size);
+    size_t num_moves = 0;
+    while (!state->scored && num_moves < max_moves) {
+        const go_color color = state->turn;
+        const go_move move = go_bitstate_play_playout(state, rng);
+        mc_amaf_record(amaf, GO_POINT(state, move), color);
+        num_moves++;
+    }
+
+    if (stats) {
+        stats->num_playouts++;
+        stats->num_moves += num_moves;
+        if (!state->scored) {
+            stats->num_capped++;
+        }
+    }
+
+    if (!state->scored) {
+        return go_bitstate_score(state, NULL);
+    }
+
+    return state->score;
+}
+
+int16_t mc_run_playout(struct go_state *state, const struct mc_policy *policy,
+                       struct rng *rng, struct mc_amaf *amaf, struct mc_stats *stats) {
+
+    if (policy) {
+        return mc_run_heavy_playout(state, policy, rng, amaf, stats);
+    }
+
+    return mc_run_random_playout(state, rng, amaf, stats);
+}
+
+//
+// ownership maps
+//
+
+void mc_ownership_init(struct mc_ownership *ownership, const struct go_state *state) {
+    memset(ownership, 0, sizeof(struct mc_ownership));
+    ownership->size = state->size;
+    ownership->stride = state->stride;
+}
+
+void mc_ownership_add(struct mc_ownership *ownership, const go_color *owner, bool black_won) {
+    const size_t size = ownership->size;
+    const size_t stride = ownership->stride;
+    const go_color winner = black_won ? GO_COLOR_BLACK : GO_COLOR_WHITE;
+
+    ownership->num_playouts++;
+    if (black_won) {
+        ownership->num_black_wins++;
+    }
+
+    for (size_t row = 1; row <= size; row++) {
+        for (size_t col = 1; col <= size; col++) {
+            const go_point point = row * stride + col;
+
+            if (owner[point] == GO_COLOR_BLACK) {
+                ownership->black[point]++;
+            }
+            else if (owner[point] == GO_COLOR_WHITE) {
+                ownership->white[point]++;
+            }
+
+            if (owner[point] == winner) {
+                ownership->winner[point]++;
+            }
+        }
+    }
+}
+
+// Adds the playouts of other to ownership.
+static void _ownership_merge(struct mc_ownership *ownership, const struct mc_ownership *other) {
+    ownership->num_playouts += other->num_playouts;
+    ownership->num_black_wins += other->num_black_wins;
+    for (size_t i = 0; i < GO_MAX_POINTS; i++) {
+        ownership->black[i] += other->black[i];
+        ownership->white[i] += other->white[i];
+        ownership->winner[i] += other->winner[i];
+    }
+}
+
+double mc_ownership_value(const struct mc_ownership *ownership, go_move move) {
+    if (!ownership->num_playouts) {
+        return 0.;
+    }
+
+    const go_point point = GO_POINT(ownership, move);
+    return ((double) ownership->black[point] - ownership->white[point]) / ownership->num_playouts;
+}
+
+double mc_ownership_criticality(const struct mc_ownership *ownership, go_move move) {
+    if (!ownership->num_playouts) {
+        return 0.;
+    }
+
+    const go_point point = GO_POINT(ownership, move);
+    const double n = ownership->num_playouts;
+    const double black_wins = ownership->num_black_wins / n;
+
+    // P(owned by winner) - P(black) P(black wins) - P(white) P(white wins)
+    return ownership->winner[point] / n -
+        (ownership->black[point] / n) * black_wins -
+        (ownership->white[point] / n) * (1. - black_wins);
+}
+
+double mc_ownership_score(const struct mc_ownership *ownership) {
+    const size_t size = ownership->size;
+
+    double score = 0.;
+    for (size_t row = 1; row <= size; row++) {
+        for (size_t col = 1; col <= size; col++) {
+            score += mc_ownership_value(ownership, GO_MOVE(row, col));
+        }
+    }
+
+    return score;
+}
+
+//
+// parallel playouts
+//
+
+// playouts claimed by a worker at a time, run as one batch
+#define PLAYOUT_CHUNK GO_BATCH_MAX
+
+static struct pool *_pool = NULL;
+static uint64_t _playouts_calls = 0;
+
+struct _playouts_job {
+    const struct go_state *state;
+    uint64_t seed;
+    size_t num_playouts;
+    size_t next; // first unclaimed playout, advanced atomically
+    struct playout_result *results; // per worker
+    struct mc_ownership *ownerships; // per worker, NULL if not wanted
+};
+
+static void _result_add(struct playout_result *result, int16_t score) {
+    assert(score >= -MC_MAX_SCORE && score <= MC_MAX_SCORE);
+
+    result->num_playouts++;
+    if (score - MC_KOMI > 0) {
+        result->num_black_wins++;
+    }
+    result->mean_score += score;
+    result->histogram[score + MC_MAX_SCORE]++;
+}
+
+// Runs the playouts from first to last one at a time on bitstates, which
+// unlike the batch check superko against the state's history.
+static void _playouts_single(struct _playouts_job *job, size_t first, size_t last,
+                             struct playout_result *result, struct mc_ownership *ownership) {
+    struct go_bitstate state;
+    go_color owner[GO_MAX_POINTS];
+    struct rng rng;
+    for (size_t i = first; i < last; i++) {
+        rng_init_seed(&rng, job->seed, i);
+        go_bitstate_from_state(&state, job->state);
+
+        const int16_t score = mc_run_bitstate_playout(&state, &rng, NULL, &result->stats);
+        _result_add(result, score);
+
+        if (ownership) {
+            go_bitstate_score(&state, owner);
+            mc_ownership_add(ownership, owner, score - MC_KOMI > 0);
+        }
+    }
+}
+
+// Runs the playouts from first to last in the lanes of one batch.
+static void _playouts_batch(struct _playouts_job *job, size_t first, size_t last,
+                            struct playout_result *result, struct mc_ownership *ownership,
+                            struct go_batch *batch) {
+    const size_t count = last - first;
+    const size_t max_moves = MC_MAX_MOVES(job->state->size);
+
+    go_batch_setup(batch, job->state, count);
+    for (size_t l = 0; l < count; l++) {
+        rng_init_seed(&batch->rng[l], job->seed, first + l);
+    }
+
+    go_batch_run(batch, max_moves);
+
+    go_color owner[GO_MAX_POINTS];
+    for (size_t l = 0; l < count; l++) {
+        const int16_t score = batch->score[l];
+        _result_add(result, score);
+
+        result->stats.num_playouts++;
+        result->stats.num_moves += batch->num_moves[l];
+        if (!batch->done[l]) {
+            result->stats.num_capped++;
+        }
+
+        if (ownership) {
+            go_batch_owner(batch, l, owner);
+            mc_ownership_add(ownership, owner, score - MC_KOMI > 0);
+        }
+    }
+}
+
+static void _playouts_worker(void *arg, size_t worker) {
+    struct _playouts_job *job = arg;
+    struct playout_result *result = &job->results[worker];
+    struct mc_ownership *ownership = job->ownerships ? &job->ownerships[worker] : NULL;
+
+    // the batch can't check superko, or play from a finished game
+    const bool single = job->state->scored || job->state->history;
+
+    struct go_batch batch;
+    while (1) {
+        const size_t first = __atomic_fetch_add(&job->next, PLAYOUT_CHUNK, __ATOMIC_RELAXED);
+        if (first >= job->num_playouts) {
+            break;
+        }
+
+        const size_t last = (first + PLAYOUT_CHUNK < job->num_playouts) ?
+            first + PLAYOUT_CHUNK : job->num_playouts;
+
+        if (single) {
+            _playouts_single(job, first, last, result, ownership);
+        }
+        else {
+            _playouts_batch(job, first, last, result, ownership, &batch);
+        }
+    }
+}
+
+bool mc_set_threads(size_t num_threads) {
+    if (_pool && pool_size(_pool) == num_threads) {
+        return true;
+    }
+
+    pool_free(_pool);
+    _pool = pool_new(num_threads);
+    return _pool != NULL;
+}
+
+size_t mc_get_threads(void) {
+    return _pool ? pool_size(_pool) : pool_default_size();
+}
+
+static bool _run_playouts(const struct go_state *state, size_t n, struct playout_result *result,
+                          struct mc_ownership *ownership) {
+    memset(result, 0, sizeof(struct playout_result));
+
+    if (!_pool && !mc_set_threads(pool_default_size())) {
+        return false;
+    }
+
+    const size_t num_workers = pool_size(_pool);
+    struct playout_result *results = calloc(num_workers, sizeof(struct playout_result));
+    struct mc_ownership *ownerships = NULL;
+    if (ownership) {
+        ownerships = malloc(num_workers * sizeof(struct mc_ownership));
+    }
+
+    if (!results || (ownership && !ownerships)) {
+        // memory allocation error
+        free(results);
+        free(ownerships);
+        return false;
+    }
+
+    for (size_t w = 0; ownership && w < num_workers; w++) {
+        mc_ownership_init(&ownerships[w], state);
+    }
+
+    struct _playouts_job job;
+    job.state = state;
+    job.seed = rng_get_seed() ^ (0x9E3779B97F4A7C15ULL * ++_playouts_calls);
+    job.num_playouts = n;
+    job.next = 0;
+    job.results = results;
+    job.ownerships = ownerships;
+
+    pool_run(_pool, _playouts_worker, &job);
+
+    for (size_t w = 0; w < num_workers; w++) {
+        result->num_playouts += results[w].num_playouts;
+        result->num_black_wins += results[w].num_black_wins;
+        result->mean_score += results[w].mean_score;
+        for (size_t i = 0; i < 2 * MC_MAX_SCORE + 1; i++) {
+            result->histogram[i] += results[w].histogram[i];
+        }
+
+        result->stats.num_playouts += results[w].stats.num_playouts;
+        result->stats.num_moves += results[w].stats.num_moves;
+        result->stats.num_capped += results[w].stats.num_capped;
+
+        if (ownership) {
+            _ownership_merge(ownership, &ownerships[w]);
+        }
+    }
+
+    if (result->num_playouts) {
+        result->mean_score /= result->num_playouts;
+    }
+
+    free(results);
+    free(ownerships);
+    return true;
+}
+
+bool mc_run_playouts(const struct go_state *state, size_t n, struct playout_result *result) {
+    return _run_playouts(state, n, result, NULL);
+}
+
+bool mc_run_ownership(const struct go_state *state, size_t n, struct playout_result *result,
+                      struct mc_ownership *ownership) {
+    return _run_playouts(state, n, result, ownership);
+}
+
+//
+// tree search
+//
+
+//
+// Every node of a tree lives in the tree's store: an arena, plus a
+// transposition table from position keys to nodes, so that move orders
+// reaching the same position share one node. The table is open addressed
+// with linear probing and never shrinks; slots are claimed and filled with
+// compare and swap, so lookups and inserts need no lock. It grows in
+// levels rather than by rehashing, which would need every thread to stop:
+// once the newest level is half full, a level twice its size is added for
+// new entries, and lookups search every level, newest first. When a probe
+// sequence is full, or two threads insert the same position into different
+// levels, the new node simply isn't shared. Nodes don't keep
+// their position, so the 64 bit key is trusted: a collision only mixes the
+// statistics of two positions, and a move of the wrong position fails to
+// play and ends the descent.
+//
+
+// slots of the first level, which the others double
+#define TABLE_MIN_SIZE ((size_t) 1 << 12)
+#define TABLE_LEVELS 20
+#define TABLE_PROBES 32
+
+struct _entry {
+    uint64_t key; // 0 for an empty slot
+    struct mcts_tree *node;
+};
 
-    struct mcts_tree *tree = malloc(
-        sizeof(struct mcts_tree) +
-        num_moves * sizeof(struct mcts_tree*)
-    );
+struct _table {
+    size_t mask;  // slots minus one
+    size_t count; // slots claimed
+    struct _entry entries[];
+};
 
+struct mcts_store {
+    struct mcts_tree *root;
+    struct go_state state; // of the root
+    struct arena *arena;
+    size_t num_nodes;
+    struct _table *tables[TABLE_LEVELS]; // NULL past the newest level
+};
+
+static struct _table *_table_new(size_t size) {
+    struct _table *table = calloc(1, sizeof(struct _table) + size * sizeof(struct _entry));
+    if (table) {
+        table->mask = size - 1;
+    }
+
+    return table;
+}
+
+static struct mcts_store *_store_new(void) {
+    struct mcts_store *store = malloc(sizeof(struct mcts_store));
+    if (!store) {
+        return NULL;
+    }
+
+    store->root = NULL;
+    store->num_nodes = 0;
+    store->arena = arena_new();
+    for (size_t level = 0; level < TABLE_LEVELS; level++) {
+        store->tables[level] = NULL;
+    }
+    store->tables[0] = _table_new(TABLE_MIN_SIZE);
+    if (!store->arena || !store->tables[0]) {
+        arena_free(store->arena);
+        free(store->tables[0]);
+        free(store);
+        return NULL;
+    }
+
+    return store;
+}
+
+static void _store_free(struct mcts_store *store) {
+    arena_free(store->arena);
+    for (size_t level = 0; level < TABLE_LEVELS; level++) {
+        free(store->tables[level]);
+    }
+    free(store);
+}
+
+// The position hash only covers stones; fold in the rest of the state that
+// decides the legal moves and the outcome. Zero marks empty slots, so a
+// zero key is stored as 1 instead.
+static uint64_t _key(const struct go_state *state) {
+    uint64_t z = (uint64_t) state->turn | ((uint64_t) state->ko << 8) |
+        ((uint64_t) state->passed << 24) | ((uint64_t) state->scored << 32);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    const uint64_t key = state->hash ^ z;
+    return key ? key : 1;
+}
+
+// number of levels, the newest being the last
+static size_t _table_levels(struct mcts_store *store) {
+    size_t levels = 1;
+    while (levels < TABLE_LEVELS && __atomic_load_n(&store->tables[levels], __ATOMIC_ACQUIRE)) {
+        levels++;
+    }
+
+    return levels;
+}
+
+static struct mcts_tree *_level_find(struct _table *table, uint64_t key) {
+    size_t i = key & table->mask;
+    for (size_t n = 0; n < TABLE_PROBES; n++) {
+        const uint64_t found = __atomic_load_n(&table->entries[i].key, __ATOMIC_ACQUIRE);
+        if (!found) {
+            return NULL;
+        }
+
+        if (found == key) {
+            // NULL while another thread is still inserting
+            return __atomic_load_n(&table->entries[i].node, __ATOMIC_ACQUIRE);
+        }
+
+        i = (i + 1) & table->mask;
+    }
+
+    return NULL;
+}
+
+static struct mcts_tree *_table_find(struct mcts_store *store, uint64_t key) {
+    for (size_t level = _table_levels(store); level-- > 0;) {
+        struct mcts_tree *node = _level_find(store->tables[level], key);
+        if (node) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+// Returns the level after the given one, adding it if needed, or the given
+// level itself if there is no room for another.
+static struct _table *_table_grow(struct mcts_store *store, size_t level) {
+    if (level + 1 == TABLE_LEVELS) {
+        return store->tables[level];
+    }
+
+    struct _table *table = _table_new(2 * (store->tables[level]->mask + 1));
+    if (!table) {
+        // memory allocation error, keep filling the current level
+        return store->tables[level];
+    }
+
+    struct _table *other = NULL;
+    if (!__atomic_compare_exchange_n(&store->tables[level + 1], &other, table, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(table);
+        return other;
+    }
+
+    return table;
+}
+
+// Returns the node in the table for the position of node, which is node
+// itself unless another one got there first, or NULL if the table has no
+// room for it.
+static struct mcts_tree *_table_insert(struct mcts_store *store, struct mcts_tree *node) {
+    const uint64_t key = node->key;
+
+    const size_t level = _table_levels(store) - 1;
+    struct _table *table = store->tables[level];
+    if (2 * __atomic_load_n(&table->count, __ATOMIC_RELAXED) >= table->mask + 1) {
+        table = _table_grow(store, level);
+    }
+
+    size_t i = key & table->mask;
+    for (size_t n = 0; n < TABLE_PROBES; n++) {
+        struct _entry *entry = &table->entries[i];
+
+        uint64_t found = 0;
+        if (__atomic_compare_exchange_n(&entry->key, &found, key, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_fetch_add(&table->count, 1, __ATOMIC_RELAXED);
+            found = key;
+        }
+
+        if (found == key) {
+            struct mcts_tree *other = NULL;
+            if (__atomic_compare_exchange_n(&entry->node, &other, node, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return node;
+            }
+            return other;
+        }
+
+        i = (i + 1) & table->mask;
+    }
+
+    return NULL;
+}
+
+// Nodes start out as bare leaves. Their moves are only generated once
+// they have seen EXPAND_THRESHOLD playouts, by whichever thread gets there
+// first; the phase then goes from MOVES_NONE through MOVES_BUSY to
+// MOVES_DONE, and the per move arrays may only be read once it is done.
+#define MOVES_NONE 0
+#define MOVES_BUSY 1
+#define MOVES_DONE 2
+
+// per move arrays in order of decreasing alignment, in one block
+static size_t _moves_size(size_t num_moves) {
+    return num_moves * sizeof(struct mcts_tree*) +
+        num_moves * 5 * sizeof(uint32_t) +
+        num_moves * sizeof(float) +
+        num_moves * sizeof(uint16_t);
+}
+
+static void _moves_link(struct mcts_tree *tree, void *block) {
+    const size_t num_moves = tree->num_moves;
+    tree->subtrees = block;
+    tree->visits = (uint32_t*) &tree->subtrees[num_moves];
+    tree->black_wins = tree->visits + num_moves;
+    tree->pending = tree->black_wins + num_moves;
+    tree->amaf_visits = tree->pending + num_moves;
+    tree->amaf_black_wins = tree->amaf_visits + num_moves;
+    tree->priors = (float*) (tree->amaf_black_wins + num_moves);
+    tree->moves = (uint16_t*) (tree->priors + num_moves);
+}
+
+// Allocates the per move arrays with zero statistics.
+static bool _moves_new(struct mcts_tree *tree, size_t num_moves) {
+    void *block = NULL;
+    if (num_moves) {
+        block = arena_alloc(tree->store->arena, _moves_size(num_moves));
+        if (!block) {
+            return false;
+        }
+    }
+
+    tree->num_moves = num_moves;
+    _moves_link(tree, block);
+    for (size_t i = 0; i < num_moves; i++) {
+        tree->subtrees[i] = NULL;
+        tree->visits[i] = 0;
+        tree->black_wins[i] = 0;
+        tree->pending[i] = 0;
+        tree->amaf_visits[i] = 0;
+        tree->amaf_black_wins[i] = 0;
+    }
+
+    return true;
+}
+
+static size_t _num_moves(const struct mcts_tree *tree) {
+    return (__atomic_load_n(&tree->phase, __ATOMIC_ACQUIRE) == MOVES_DONE) ? tree->num_moves : 0;
+}
+
+static struct mcts_tree *_node_new(struct mcts_store *store, const struct go_state *state) {
+    struct mcts_tree *tree = arena_alloc(store->arena, sizeof(struct mcts_tree));
     if (!tree) {
         return NULL;
     }
+    __atomic_fetch_add(&store->num_nodes, 1, __ATOMIC_RELAXED);
 
-    go_copy(state, &tree->state);
+    tree->key = _key(state);
+    tree->turn = state->turn;
     tree->num_playouts = 0;
     tree->num_black_wins = 0;
-    tree->parent = NULL;
-    tree->num_moves = num_moves;
+    tree->store = store;
+    tree->ownership = NULL;
+    tree->ranked = false;
+    tree->num_moves = 0;
+    _moves_link(tree, NULL);
+
+    // finished games are leaves
+    tree->phase = state->scored ? MOVES_DONE : MOVES_NONE;
+
+    return tree;
+}
+
+struct _ranked {
+    float prior;
+    uint16_t move;
+    uint16_t index; // keeps the order of equal priors stable
+};
+
+static int _by_prior(const void *a, const void *b) {
+    const struct _ranked *x = a;
+    const struct _ranked *y = b;
+
+    if (x->prior != y->prior) {
+        return (x->prior > y->prior) ? -1 : 1;
+    }
+    return (int) x->index - (int) y->index;
+}
+
+// Generates the moves of a node, whose position is state, ranked by prior
+// when there is a policy. Returns false if the node has no moves yet:
+// another thread is busy generating them, or memory ran out.
+static bool _generate(struct mcts_tree *tree, const struct go_state *state,
+                      const struct mc_policy *policy) {
+    int phase = __atomic_load_n(&tree->phase, __ATOMIC_ACQUIRE);
+    if (phase == MOVES_DONE) {
+        return true;
+    }
+
+    if (phase != MOVES_NONE || !__atomic_compare_exchange_n(&tree->phase, &phase, MOVES_BUSY, false,
+                                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    size_t num_moves = 0;
+    uint16_t moves[512];
+    go_moves(state, moves, &num_moves);
+
+    if (!_moves_new(tree, num_moves)) {
+        // memory allocation error, let a later playout try again
+        __atomic_store_n(&tree->phase, MOVES_NONE, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    struct _ranked ranked[512];
+    float total = 0;
     for (size_t i = 0; i < num_moves; i++) {
-        tree->moves[i] = moves[i];
-        tree->subtrees[i] = NULL;
+        ranked[i].prior = policy ? mc_policy_weight(policy, state, moves[i]) : 1;
+        ranked[i].move = moves[i];
+        ranked[i].index = i;
+        total += ranked[i].prior;
+    }
+
+    if (policy) {
+        qsort(ranked, num_moves, sizeof(struct _ranked), _by_prior);
+        tree->ranked = true;
+    }
+
+    for (size_t i = 0; i < num_moves; i++) {
+        tree->moves[i] = ranked[i].move;
+        tree->priors[i] = (total > 0) ? ranked[i].prior / total : 1.f / num_moves;
+    }
+
+    __atomic_store_n(&tree->phase, MOVES_DONE, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Copies the graph below a node into store, in depth first order. Nodes
+// are entered in the table before their children are copied, which keeps
+// shared nodes shared and ends cycles through repeated positions.
+static struct mcts_tree *_node_copy(struct mcts_store *store, const struct mcts_tree *tree) {
+
+    struct mcts_tree *copy = _table_find(store, tree->key);
+    if (copy) {
+        return copy;
     }
 
+    assert(tree->phase != MOVES_BUSY);
+
+    copy = arena_alloc(store->arena, sizeof(struct mcts_tree));
+    if (!copy) {
+        return NULL;
+    }
+    store->num_nodes++;
+
+    memcpy(copy, tree, sizeof(struct mcts_tree));
+    copy->store = store;
+    if (tree->num_moves) {
+        const size_t size = _moves_size(tree->num_moves);
+        void *block = arena_alloc(store->arena, size);
+        if (!block) {
+            return NULL;
+        }
+
+        memcpy(block, tree->subtrees, size);
+        _moves_link(copy, block);
+        for (size_t i = 0; i < tree->num_moves; i++) {
+            copy->subtrees[i] = NULL;
+        }
+    }
+
+    if (tree->ownership) {
+        copy->ownership = arena_alloc(store->arena, sizeof(struct mc_ownership));
+        if (!copy->ownership) {
+            return NULL;
+        }
+        memcpy(copy->ownership, tree->ownership, sizeof(struct mc_ownership));
+    }
+
+    if (_table_insert(store, copy) != copy) {
+        // the table is full, give up rather than risk copying a cycle
+        return NULL;
+    }
+
+    for (size_t i = 0; i < tree->num_moves; i++) {
+        if (tree->subtrees[i]) {
+            copy->subtrees[i] = _node_copy(store, tree->subtrees[i]);
+            if (!copy->subtrees[i]) {
+                return NULL;
+            }
+        }
+    }
+
+    return copy;
+}
+
+struct mcts_tree *mcts_new(struct go_state *state) {
+    struct mcts_store *store = _store_new();
+    if (!store) {
+        return NULL;
+    }
+
+    go_copy(state, &store->state);
+
+    // the change list belongs to the caller's state
+    store->state.changes = NULL;
+
+    // the root's moves are generated by the first search, with its policy
+    struct mcts_tree *tree = _node_new(store, state);
+    if (!tree) {
+        _store_free(store);
+        return NULL;
+    }
+
+    _table_insert(store, tree);
+    store->root = tree;
     return tree;
 }
 
@@ -58,10 +789,25 @@ struct mcts_tree *mcts_descend(struct mcts_tree *tree, uint16_t move) {
     for (size_t i = 0; i < tree->num_moves; i++) {
         if (tree->moves[i] == move && tree->subtrees[i]) {
             struct mcts_tree *subtree = tree->subtrees[i];
-            subtree->parent = NULL;
-            tree->subtrees[i] = NULL;
+
+            struct mcts_store *store = _store_new();
+            struct mcts_tree *copy = store ? _node_copy(store, subtree) : NULL;
+            if (!copy) {
+                // memory allocation error, keep the subtree in place along
+                // with its discarded siblings
+                if (store) {
+                    _store_free(store);
+                }
+                tree->store->root = subtree;
+                go_play(&tree->store->state, move);
+                return subtree;
+            }
+
+            store->root = copy;
+            go_copy(&tree->store->state, &store->state);
+            go_play(&store->state, move);
             mcts_free(tree);
-            return subtree;
+            return copy;
         }
     }
 
@@ -74,133 +820,729 @@ void mcts_free(struct mcts_tree *tree) {
         return;
     }
 
-    assert(!tree->parent);
+    assert(tree->store->root == tree);
+    _store_free(tree->store);
+}
 
-    for (size_t i = 0; i < tree->num_moves; i++) {
-        if (tree->subtrees[i]) {
-            tree->subtrees[i]->parent = NULL;
-            mcts_free(tree->subtrees[i]);
-            tree->subtrees[i] = NULL;
-        }
+size_t mcts_count_nodes(const struct mcts_tree *tree) {
+    return __atomic_load_n(&tree->store->num_nodes, __ATOMIC_RELAXED);
+}
+
+bool mcts_track_ownership(struct mcts_tree *tree) {
+    if (tree->ownership) {
+        return true;
+    }
+
+    tree->ownership = arena_alloc(tree->store->arena, sizeof(struct mc_ownership));
+    if (!tree->ownership) {
+        // memory allocation error
+        return false;
     }
 
-    free(tree);
+    // every position of the tree has the root's board size
+    mc_ownership_init(tree->ownership, &tree->store->state);
+    return true;
+}
+
+const struct mc_ownership *mcts_ownership(const struct mcts_tree *tree) {
+    return tree->ownership;
 }
 
 #define EXPAND_THRESHOLD 2
+
+// wins subtracted from a move's record when choosing the move to play
 #define OPTIMISM 10
 
-void mcts_run_random_playout(struct mcts_tree *tree) {
-    unsigned int rand_state = rand();
+// RAVE schedule: the AMAF value's weight is sqrt(k / (3n + k)) after n
+// playouts, so it falls to one half at n = RAVE_EQUIV
+#define RAVE_EQUIV 1000
 
-    // descend tree, choosing max UCT node at each level
-    size_t depth = 1;
-    while (1) {
-        
-        if (tree->num_playouts < EXPAND_THRESHOLD) {
+// value of a move with no statistics at all, to try each move once
+#define FIRST_PLAY_URGENCY 1.1
+
+// UCB1 exploration coefficient; RAVE already does most of the exploring
+#define UCB_C 0.2
+
+// weight of the prior bias, which decays as 1 / (1 + visits)
+#define PRIOR_WEIGHT 1.0
+
+// moves open to selection after N playouts: WIDEN_BASE + N^WIDEN_EXPONENT
+#define WIDEN_BASE 4
+#define WIDEN_EXPONENT 0.5
+
+// losses counted per playout in progress through a move, to spread
+// concurrent searches over different paths
+#define VIRTUAL_LOSS 3
+
+// deepest descent
+#define MAX_DEPTH 1024
+
+// Statistics are updated with atomic adds, so any number of threads can
+// search the same tree. Reads are relaxed loads, or plain loads in the
+// selection loop: a value may be a few playouts out of date, which only
+// nudges move selection. New children are published with a compare and
+// swap; ownership maps are updated under a lock.
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define ADD(x, n) __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+#define SUB(x, n) __atomic_fetch_sub(&(x), (n), __ATOMIC_RELAXED)
+
+static pthread_mutex_t _ownership_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Number of moves open to selection. Moves ranked by prior are opened
+// progressively, best first, as the node's playouts grow.
+static size_t _num_open(const struct mcts_tree *tree) {
+    if (!tree->ranked) {
+        return tree->num_moves;
+    }
+
+    const size_t num_open = WIDEN_BASE + (size_t) pow((double) LOAD(tree->num_playouts), WIDEN_EXPONENT);
+    return (num_open < tree->num_moves) ? num_open : tree->num_moves;
+}
+
+// Selects the move to descend: the win rate for the side to move, blending
+// playout and AMAF results, plus a UCB1 term and a prior bias. The values
+// are computed without branches into an array so the loop vectorizes, and
+// the argmax starts at a random move to break ties.
+static size_t _select(const struct mcts_tree *tree, struct rng *rng) {
+    const size_t num_moves = _num_open(tree);
+    const bool black = tree->turn == GO_COLOR_BLACK;
+
+    // black's win rate r is worth offset + sign * r to the side to move,
+    // and virtual losses are wins for the opponent
+    const float offset = black ? 0.f : 1.f;
+    const float sign = black ? 1.f : -1.f;
+    const float loss_wins = black ? 0.f : VIRTUAL_LOSS;
+
+    // sqrt(log N) is shared by every move
+    const float explore = (float) UCB_C * sqrtf(logf((float) LOAD(tree->num_playouts) + 1.f));
+
+    const uint32_t *restrict visits = tree->visits;
+    const uint32_t *restrict black_wins = tree->black_wins;
+    const uint32_t *restrict pending = tree->pending;
+    const uint32_t *restrict amaf_visits = tree->amaf_visits;
+    const uint32_t *restrict amaf_black_wins = tree->amaf_black_wins;
+    const float *restrict priors = tree->priors;
+
+    const float rave_equiv = RAVE_EQUIV;
+    const float fpu = FIRST_PLAY_URGENCY;
+    const float prior_weight = PRIOR_WEIGHT;
+
+    // Conditions are tested on the integer counts and folded in as 0/1
+    // factors, since the compiler won't if-convert branches around floating
+    // point operations. Counts go through int32_t, which converts to float
+    // in vector registers (they stay far below 2^31).
+    float value[512];
+    for (size_t i = 0; i < num_moves; i++) {
+        const uint32_t n = visits[i] + VIRTUAL_LOSS * pending[i];
+        const uint32_t amaf_n = amaf_visits[i];
+
+        const float nf = (float) (int32_t) n;
+        const float wins = (float) (int32_t) black_wins[i] + loss_wins * (float) (int32_t) pending[i];
+        const float amaf_wins = (float) (int32_t) amaf_black_wins[i];
+
+        // max(n, 1) and max(amaf_n, 1)
+        const float n_div = (float) (int32_t) (n + (n == 0));
+        const float amaf_div = (float) (int32_t) (amaf_n + (amaf_n == 0));
+
+        const float has_amaf = (float) (int32_t) (amaf_n != 0);
+        const float seen = (float) (int32_t) ((n | amaf_n) != 0);
+
+        const float beta = has_amaf * sqrtf(rave_equiv / (3.f * nf + rave_equiv));
+        const float rate = beta * amaf_wins / amaf_div + (1.f - beta) * wins / n_div;
+
+        const float known = offset + sign * rate + explore / sqrtf(nf + 1.f);
+        value[i] = seen * known + (1.f - seen) * fpu + prior_weight * priors[i] / (nf + 1.f);
+    }
+
+    const size_t start = rng_bounded(rng, num_moves);
+    size_t best = start;
+    float best_value = value[start];
+    for (size_t i = start + 1; i < num_moves; i++) {
+        best = (value[i] > best_value) ? i : best;
+        best_value = (value[i] > best_value) ? value[i] : best_value;
+    }
+    for (size_t i = 0; i < start; i++) {
+        best = (value[i] > best_value) ? i : best;
+        best_value = (value[i] > best_value) ? value[i] : best_value;
+    }
+
+    return best;
+}
+
+// Returns the child for move i, whose position is state, expanding it if
+// needed, or NULL on allocation failure.
+static struct mcts_tree *_expand(struct mcts_tree *tree, size_t i, const struct go_state *state) {
+    struct mcts_tree *subtree = __atomic_load_n(&tree->subtrees[i], __ATOMIC_ACQUIRE);
+    if (subtree) {
+        return subtree;
+    }
+
+    // reuse the node of a transposition
+    struct mcts_tree *node = _table_find(tree->store, _key(state));
+    if (!node) {
+        node = _node_new(tree->store, state);
+        if (!node) {
+            return NULL;
+        }
+
+        struct mcts_tree *shared = _table_insert(tree->store, node);
+        if (shared) {
+            node = shared;
+        }
+    }
+
+    // another thread may have expanded the move meanwhile, in which case
+    // our node may stay unused in the arena
+    struct mcts_tree *expected = NULL;
+    if (!__atomic_compare_exchange_n(&tree->subtrees[i], &expected, node, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return expected;
+    }
+
+    return node;
+}
+
+// Whether node is one of path[0] to path[depth].
+static bool _on_path(struct mcts_tree *const *path, size_t depth, const struct mcts_tree *node) {
+    for (size_t d = 0; d <= depth; d++) {
+        if (path[d] == node) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool mcts_walker_init(struct mcts_walker *walker, const struct mcts_tree *tree) {
+    assert(tree->store->root == tree);
+
+    go_copy(&tree->store->state, &walker->state);
+    return go_undo_init(&walker->undo);
+}
+
+void mcts_walker_free(struct mcts_walker *walker) {
+    go_undo_free(&walker->undo);
+}
+
+void mcts_run_playout(struct mcts_tree *tree, const struct mc_policy *policy,
+                      struct rng *rng, struct mcts_walker *walker) {
+
+    struct go_state *state = &walker->state;
+
+    struct mc_amaf amaf;
+    memset(&amaf, 0, sizeof(amaf));
+
+    // descend tree, playing the moves on the walker's state; nodes can be
+    // reached by several paths, so the path and the moves taken are kept
+    // for backpropagation
+    struct mcts_tree *path[MAX_DEPTH];
+    size_t taken[MAX_DEPTH];
+    size_t depth = 0;
+    size_t num_taken = 0;
+    path[0] = tree;
+    while (depth + 1 < MAX_DEPTH) {
+
+        if (LOAD(tree->num_playouts) < EXPAND_THRESHOLD) {
             break;
         }
 
-        if (tree->num_moves == 0) {
+        if (!_generate(tree, state, policy) || tree->num_moves == 0) {
             break;
         }
 
-        //double curr_wr = (double) tree->num_black_wins / tree->num_playouts;
-        
-        double best_uct = (tree->state.turn == GO_COLOR_BLACK) ? -100. : 100.;
-        struct mcts_tree *best_subtree = NULL;
-        for (size_t i = 0; i < tree->num_moves; i++) {
-            if (!tree->subtrees[i]) {
-                
-                // derive successor position
-                struct go_state sub_state;
-                go_copy(&tree->state, &sub_state);
-                go_play(&sub_state, tree->moves[i]);
-                
-                // expand
-                tree->subtrees[i] = mcts_new(&sub_state);
-                tree->subtrees[i]->parent = tree;
-
-                // always choose newly-expanded nodes
-                best_subtree = tree->subtrees[i];
-                break;
-            }
-            else {
-                struct mcts_tree *st = tree->subtrees[i];
-
-                double wr = (double) (st->num_black_wins + (tree->state.turn == GO_COLOR_BLACK) ? OPTIMISM : -OPTIMISM) / st->num_playouts;
-                double jitter = 0.001 * rand_r(&rand_state) / RAND_MAX;
-                wr += jitter;
-                double uct = wr;
-
-                if (tree->state.turn == GO_COLOR_BLACK) {
-                    // max node
-                    if (uct > best_uct) {
-                        best_uct = uct;
-                        best_subtree = st;
-                    }
-                }
-                else {
-                    // min node
-                    if (uct < best_uct) {
-                        best_uct = uct;
-                        best_subtree = st;
-                    }
-                }
+        const size_t best = _select(tree, rng);
+        const go_move move = tree->moves[best];
+
+        // taken back out of the AMAF record if the move can't be played
+        const go_point point = GO_POINT(state, move);
+        const uint16_t first_ply = amaf.ply[point];
+        mc_amaf_play(&amaf, state, move);
+
+        struct mcts_tree *subtree = NULL;
+        if (go_play_undoable(state, move, &walker->undo)) {
+            subtree = _expand(tree, best, state);
+            if (!subtree) {
+                go_undo(state, &walker->undo);
             }
         }
 
-        assert(best_subtree != NULL);
-        tree = best_subtree;
+        if (!subtree) {
+            // memory allocation error, or a move of a colliding position;
+            // play out from here
+            amaf.ply[point] = first_ply;
+            amaf.num_plies--;
+            break;
+        }
+
+        ADD(tree->pending[best], 1);
+        taken[depth] = best;
+        num_taken++;
+
+        // A position repeated by the move closes a cycle of the graph. The
+        // move is scored, but the node already on the path isn't entered
+        // again, which would count the playout twice there.
+        if (_on_path(path, depth, subtree)) {
+            break;
+        }
+
+        tree = subtree;
         depth++;
+        path[depth] = tree;
+    }
+
+    // final ownership is only scored if some node on the path tracks it
+    bool have_owner = false;
+    for (size_t d = 0; d <= depth; d++) {
+        if (path[d]->ownership) {
+            have_owner = true;
+            break;
+        }
+    }
+
+    // perform playout, on bitboards unless it follows a policy
+    go_color owner[GO_MAX_POINTS];
+    int16_t score;
+    if (policy) {
+        struct go_state playout_state;
+        go_copy(state, &playout_state);
+        score = mc_run_heavy_playout(&playout_state, policy, rng, &amaf, NULL);
+        if (have_owner) {
+            go_score(&playout_state, owner);
+        }
+    }
+    else {
+        struct go_bitstate playout_state;
+        go_bitstate_from_state(&playout_state, state);
+        score = mc_run_bitstate_playout(&playout_state, rng, &amaf, NULL);
+        if (have_owner) {
+            go_bitstate_score(&playout_state, owner);
+        }
     }
 
-    // perform playout
-    struct go_state playout_state;
-    go_copy(&tree->state, &playout_state);
-    mc_run_random_playout(&playout_state);
+    // return the walker to where it started
+    for (size_t d = 0; d < num_taken; d++) {
+        go_undo(state, &walker->undo);
+    }
 
-    bool b_won = (playout_state.score - 5.5) > 0 ? true : false;
+    bool b_won = (score - MC_KOMI) > 0 ? true : false;
 
     // propagate back to root
-    while (tree) {
-        tree->num_playouts++;
+    for (size_t d = depth + 1; d-- > 0;) {
+        tree = path[d];
+        ADD(tree->num_playouts, 1);
         if (b_won) {
-            tree->num_black_wins++;
+            ADD(tree->num_black_wins, 1);
         }
 
-        tree = tree->parent;
+        if (d < num_taken) {
+            const size_t i = taken[d];
+            ADD(tree->visits[i], 1);
+            if (b_won) {
+                ADD(tree->black_wins[i], 1);
+            }
+            SUB(tree->pending[i], 1);
+        }
+
+        if (have_owner && tree->ownership) {
+            pthread_mutex_lock(&_ownership_lock);
+            mc_ownership_add(tree->ownership, owner, b_won);
+            pthread_mutex_unlock(&_ownership_lock);
+        }
+
+        // update the AMAF statistics of every move that the side to move
+        // here played first somewhere below this node
+        const size_t num_moves = _num_moves(tree);
+        for (size_t i = 0; i < num_moves; i++) {
+            const go_move move = tree->moves[i];
+            if (move == GO_MOVE_PASS) {
+                continue;
+            }
+
+            const go_point point = GO_POINT(state, move);
+            if (amaf.ply[point] > d && amaf.color[point] == tree->turn) {
+                ADD(tree->amaf_visits[i], 1);
+                if (b_won) {
+                    ADD(tree->amaf_black_wins[i], 1);
+                }
+            }
+        }
     }
 }
 
-uint16_t mcts_choose(struct mcts_tree *tree) {
-    unsigned int rand_state = rand();
-    
-    double best_wr = (tree->state.turn == GO_COLOR_BLACK) ? -100. : 100.;
+struct _search_job {
+    struct mcts_tree *tree;
+    const struct mc_policy *policy;
+    uint64_t seed;
+    size_t num_playouts;
+    size_t next; // playouts started so far, advanced atomically
+};
+
+static void _search_worker(void *arg, size_t worker) {
+    struct _search_job *job = arg;
+
+    struct mcts_walker walker;
+    if (!mcts_walker_init(&walker, job->tree)) {
+        // memory allocation error, other workers take over the playouts
+        return;
+    }
+
+    struct rng rng;
+    rng_init_seed(&rng, job->seed, worker);
+    while (__atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED) < job->num_playouts) {
+        mcts_run_playout(job->tree, job->policy, &rng, &walker);
+    }
+
+    mcts_walker_free(&walker);
+}
+
+bool mcts_run_playouts(struct mcts_tree *tree, const struct mc_policy *policy, size_t n) {
+    if (!_pool && !mc_set_threads(pool_default_size())) {
+        return false;
+    }
+
+    // the root is always searched, so its moves are generated right away
+    if (!_generate(tree, &tree->store->state, policy)) {
+        return false;
+    }
+
+    struct _search_job job;
+    job.tree = tree;
+    job.policy = policy;
+    job.seed = rng_get_seed() ^ (0x9E3779B97F4A7C15ULL * ++_playouts_calls);
+    job.num_playouts = n;
+    job.next = 0;
+
+    pool_run(_pool, _search_worker, &job);
+
+    // every worker failing to set up leaves playouts unclaimed
+    return job.next >= n;
+}
+
+// root statistics already merged from a private tree
+struct _merged {
+    size_t num_playouts;
+    size_t num_black_wins;
+    uint32_t visits[512];
+    uint32_t black_wins[512];
+    uint32_t amaf_visits[512];
+    uint32_t amaf_black_wins[512];
+};
+
+struct _root_job {
+    struct mcts_tree *tree;
+    const struct mc_policy *policy;
+    uint64_t seed;
+    size_t num_playouts;
+    size_t merge_interval;
+    size_t next; // playouts claimed so far, advanced atomically
+};
+
+// Adds the root statistics gathered by a private tree since the last merge
+// to the shared tree.
+static void _merge(struct mcts_tree *tree, const struct mcts_tree *private, struct _merged *merged) {
+    assert(tree->num_moves == private->num_moves);
+
+    ADD(tree->num_playouts, private->num_playouts - merged->num_playouts);
+    ADD(tree->num_black_wins, private->num_black_wins - merged->num_black_wins);
+    merged->num_playouts = private->num_playouts;
+    merged->num_black_wins = private->num_black_wins;
+
+    for (size_t i = 0; i < tree->num_moves; i++) {
+        assert(tree->moves[i] == private->moves[i]);
+
+        ADD(tree->visits[i], private->visits[i] - merged->visits[i]);
+        ADD(tree->black_wins[i], private->black_wins[i] - merged->black_wins[i]);
+        ADD(tree->amaf_visits[i], private->amaf_visits[i] - merged->amaf_visits[i]);
+        ADD(tree->amaf_black_wins[i], private->amaf_black_wins[i] - merged->amaf_black_wins[i]);
+        merged->visits[i] = private->visits[i];
+        merged->black_wins[i] = private->black_wins[i];
+        merged->amaf_visits[i] = private->amaf_visits[i];
+        merged->amaf_black_wins[i] = private->amaf_black_wins[i];
+    }
+}
+
+// Returns a new tree for the position of tree, with its root moves in the
+// same order so that statistics can be merged by index.
+static struct mcts_tree *_root_copy(const struct mcts_tree *tree) {
+    assert(tree->store->root == tree && tree->phase == MOVES_DONE);
+
+    struct mcts_store *store = _store_new();
+    if (!store) {
+        return NULL;
+    }
+
+    go_copy(&tree->store->state, &store->state);
+    struct mcts_tree *root = _node_new(store, &store->state);
+    if (!root || !_moves_new(root, tree->num_moves)) {
+        _store_free(store);
+        return NULL;
+    }
+
+    root->ranked = tree->ranked;
+    root->phase = MOVES_DONE;
+    for (size_t i = 0; i < tree->num_moves; i++) {
+        root->moves[i] = tree->moves[i];
+        root->priors[i] = tree->priors[i];
+    }
+
+    _table_insert(store, root);
+    store->root = root;
+    return root;
+}
+
+static void _root_worker(void *arg, size_t worker) {
+    struct _root_job *job = arg;
+
+    struct mcts_tree *private = _root_copy(job->tree);
+    struct _merged *merged = calloc(1, sizeof(struct _merged));
+    struct mcts_walker walker;
+    if (!private || !merged || !mcts_walker_init(&walker, private)) {
+        // memory allocation error, other workers take over the playouts
+        mcts_free(private);
+        free(merged);
+        return;
+    }
+
+    struct rng rng;
+    rng_init_seed(&rng, job->seed, worker);
+
+    while (1) {
+        const size_t first = __atomic_fetch_add(&job->next, job->merge_interval, __ATOMIC_RELAXED);
+        if (first >= job->num_playouts) {
+            break;
+        }
+
+        const size_t last = (first + job->merge_interval < job->num_playouts) ?
+            first + job->merge_interval : job->num_playouts;
+
+        for (size_t i = first; i < last; i++) {
+            mcts_run_playout(private, job->policy, &rng, &walker);
+        }
+
+        _merge(job->tree, private, merged);
+    }
+
+    mcts_walker_free(&walker);
+    mcts_free(private);
+    free(merged);
+}
+
+bool mcts_run_playouts_root(struct mcts_tree *tree, const struct mc_policy *policy,
+                            size_t n, size_t merge_interval) {
+
+    if (!_pool && !mc_set_threads(pool_default_size())) {
+        return false;
+    }
+
+    if (!_generate(tree, &tree->store->state, policy)) {
+        return false;
+    }
+
+    struct _root_job job;
+    job.tree = tree;
+    job.policy = policy;
+    job.seed = rng_get_seed() ^ (0x9E3779B97F4A7C15ULL * ++_playouts_calls);
+    job.num_playouts = n;
+    job.merge_interval = merge_interval ? merge_interval : 1;
+    job.next = 0;
+
+    pool_run(_pool, _root_worker, &job);
+
+    // every worker failing to allocate its tree leaves playouts unclaimed
+    return job.next >= n;
+}
+
+uint16_t mcts_choose(struct mcts_tree *tree, struct rng *rng) {
+    const bool black = tree->turn == GO_COLOR_BLACK;
+
+    double best_wr = -100.;
     uint16_t best_move = 0;
     for (size_t i = 0; i < tree->num_moves; i++) {
-        if (tree->subtrees[i]) {
-            struct mcts_tree *st = tree->subtrees[i];
-            double wr = (double) (st->num_black_wins - (tree->state.turn == GO_COLOR_BLACK) ? OPTIMISM : -OPTIMISM) / st->num_playouts;
-            double jitter = 0.001 * rand_r(&rand_state) / RAND_MAX;
-            wr += jitter;
-
-            if (tree->state.turn == GO_COLOR_BLACK) {
-                // max
-                if (wr > best_wr) {
-                    best_wr = wr;
-                    best_move = tree->moves[i];
-                }
-            }
-            else {
-                // min
-                if (wr < best_wr) {
-                    best_wr = wr;
-                    best_move = tree->moves[i];
-                }
-            }
+        const uint32_t n = tree->visits[i];
+        if (!n) {
+            continue;
+        }
+
+        // discount a few wins, so that moves with few visits need a
+        // clearly better record to be chosen
+        const double wins = black ? tree->black_wins[i] : n - tree->black_wins[i];
+        const double wr = (wins - OPTIMISM) / n + 0.001 * rng_double(rng);
+        if (wr > best_wr) {
+            best_wr = wr;
+            best_move = tree->moves[i];
         }
     }
 
     return best_move;
 }
+
+//
+// search driver
+//
+
+// playouts between checks whether the search is decided
+#define DECIDED_INTERVAL 64
+
+// playouts before the playout rate is trusted to estimate the rest
+#define DECIDED_MIN_PLAYOUTS 256
+
+// playouts between checks whether the tree still grows, under a node limit
+#define STALL_INTERVAL 1024
+
+// The game is expected to last until about this fraction of the board is
+// still empty, and each side gets at least ALLOT_MIN_MOVES more moves.
+#define ALLOT_END_EMPTIES 0.25
+#define ALLOT_MIN_MOVES 20
+
+struct _limits_job {
+    struct mcts_tree *tree;
+    const struct search_limits *limits;
+    uint64_t seed;
+    double start;
+    size_t next; // playouts started, advanced atomically
+    size_t done; // playouts finished
+    size_t num_nodes; // at the last check for growth
+    int stop;
+};
+
+static double _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Whether the most visited root move keeps the lead over every other move
+// even if all remaining playouts went elsewhere.
+static bool _decided(const struct mcts_tree *tree, size_t remaining) {
+    const size_t num_moves = _num_moves(tree);
+
+    size_t first = 0;
+    size_t second = 0;
+    for (size_t i = 0; i < num_moves; i++) {
+        const size_t visits = LOAD(tree->visits[i]);
+        if (visits > first) {
+            second = first;
+            first = visits;
+        }
+        else if (visits > second) {
+            second = visits;
+        }
+    }
+
+    return first - second > remaining;
+}
+
+// Checked before starting playout number started.
+static bool _should_stop(struct _limits_job *job, size_t started) {
+    const struct search_limits *limits = job->limits;
+
+    if (limits->max_playouts && started >= limits->max_playouts) {
+        return true;
+    }
+
+    if (limits->max_nodes) {
+        const size_t num_nodes = mcts_count_nodes(job->tree);
+        if (num_nodes >= limits->max_nodes) {
+            return true;
+        }
+
+        // every reachable position may already have a node
+        if (started % STALL_INTERVAL == 0 &&
+            __atomic_exchange_n(&job->num_nodes, num_nodes, __ATOMIC_RELAXED) == num_nodes) {
+            return true;
+        }
+    }
+
+    if (limits->seconds <= 0 && !limits->early_stop) {
+        return false;
+    }
+
+    const double elapsed = _now() - job->start;
+    if (limits->seconds > 0 && elapsed >= limits->seconds) {
+        return true;
+    }
+
+    if (!limits->early_stop || started % DECIDED_INTERVAL) {
+        return false;
+    }
+
+    bool bounded = false;
+    size_t remaining = SIZE_MAX;
+    if (limits->max_playouts) {
+        bounded = true;
+        remaining = limits->max_playouts - started;
+    }
+
+    const size_t done = LOAD(job->done);
+    if (limits->seconds > 0 && done >= DECIDED_MIN_PLAYOUTS) {
+        const double estimate = done / elapsed * (limits->seconds - elapsed);
+        if (estimate < remaining) {
+            bounded = true;
+            remaining = (size_t) estimate;
+        }
+    }
+
+    return bounded && _decided(job->tree, remaining);
+}
+
+static void _limits_worker(void *arg, size_t worker) {
+    struct _limits_job *job = arg;
+
+    struct mcts_walker walker;
+    if (!mcts_walker_init(&walker, job->tree)) {
+        // memory allocation error, other workers carry on
+        return;
+    }
+
+    struct rng rng;
+    rng_init_seed(&rng, job->seed, worker);
+    while (!LOAD(job->stop)) {
+        const size_t started = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (_should_stop(job, started)) {
+            __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        mcts_run_playout(job->tree, job->limits->policy, &rng, &walker);
+        ADD(job->done, 1);
+    }
+
+    mcts_walker_free(&walker);
+}
+
+size_t mcts_search(struct mcts_tree *tree, const struct search_limits *limits) {
+    assert(limits->seconds > 0 || limits->max_playouts || limits->max_nodes);
+
+    if (!_pool && !mc_set_threads(pool_default_size())) {
+        return 0;
+    }
+
+    if (tree->store->state.scored || !_generate(tree, &tree->store->state, limits->policy)) {
+        return 0;
+    }
+
+    struct _limits_job job;
+    job.tree = tree;
+    job.limits = limits;
+    job.seed = rng_get_seed() ^ (0x9E3779B97F4A7C15ULL * ++_playouts_calls);
+    job.start = _now();
+    job.next = 0;
+    job.done = 0;
+    job.num_nodes = 0;
+    job.stop = 0;
+
+    pool_run(_pool, _limits_worker, &job);
+    return job.done;
+}
+
+double mcts_allot_time(double main_time, const struct go_state *state) {
+    const double points = (double) state->size * state->size;
+
+    // both sides share the moves left
+    double moves_left = (state->num_empties - ALLOT_END_EMPTIES * points) / 2;
+    if (moves_left < ALLOT_MIN_MOVES) {
+        moves_left = ALLOT_MIN_MOVES;
+    }
+
+    return (main_time > 0) ? main_time / moves_left : 0;
+}
@@ -6,26 +6,226 @@
 #include <stddef.h>
 
 #include "go.h"
+#include "rng.h"
+#include "policy.h"
 
-void mc_run_random_playout(struct go_state *state);
+struct mc_stats {
+    size_t num_playouts;
+    size_t num_moves;
+    size_t num_capped; // playouts cut off at MC_MAX_MOVES before ending
+};
+
+// playouts longer than this are stopped and scored as they stand
+#define MC_MAX_MOVES(size) (3 * (size) * (size))
+
+// komi used to decide playout winners
+#define MC_KOMI 5.5
+
+// raw scores range from -MC_MAX_SCORE to MC_MAX_SCORE
+#define MC_MAX_SCORE (21 * 21)
+
+// The first play at each point during a simulation (tree moves, then the
+// playout), for all-moves-as-first statistics. Start from all zeros.
+struct mc_amaf {
+    uint16_t num_plies;
+    uint16_t ply[GO_MAX_POINTS]; // ply of the first play plus one, 0 if none
+    go_color color[GO_MAX_POINTS];
+};
+
+// Records a play by color at a point, or a pass if point is 0.
+static inline void mc_amaf_record(struct mc_amaf *amaf, go_point point, go_color color) {
+    if (!amaf) {
+        return;
+    }
+
+    if (point && !amaf->ply[point]) {
+        amaf->ply[point] = amaf->num_plies + 1;
+        amaf->color[point] = color;
+    }
+
+    amaf->num_plies++;
+}
+
+// Records a move about to be played in state.
+static inline void mc_amaf_play(struct mc_amaf *amaf, const struct go_state *state, go_move move) {
+    mc_amaf_record(amaf, move ? GO_POINT(state, move) : 0, state->turn);
+}
+
+// Plays random moves until the game ends and returns the raw score.
+// amaf and stats, if not NULL, are updated.
+int16_t mc_run_random_playout(struct go_state *state, struct rng *rng,
+                              struct mc_amaf *amaf, struct mc_stats *stats);
+
+// Plays the same random playout as mc_run_random_playout on a bitboard
+// state, which is much cheaper to set up and to play on.
+int16_t mc_run_bitstate_playout(struct go_bitstate *state, struct rng *rng,
+                                struct mc_amaf *amaf, struct mc_stats *stats);
+
+// Runs a heavy playout if policy is not NULL, a uniform random one if it is.
+int16_t mc_run_playout(struct go_state *state, const struct mc_policy *policy,
+                       struct rng *rng, struct mc_amaf *amaf, struct mc_stats *stats);
+
+// Final ownership of every point over a number of playouts from one
+// position. Criticality is the covariance between owning a point and
+// winning the game: near zero for settled or irrelevant points, high for
+// points whose fate decides the game.
+struct mc_ownership {
+    uint8_t  size;
+    uint8_t  stride;
+    uint32_t num_playouts;
+    uint32_t num_black_wins;
+
+    // by point
+    uint32_t black[GO_MAX_POINTS];  // playouts ending with the point black
+    uint32_t white[GO_MAX_POINTS];  // playouts ending with the point white
+    uint32_t winner[GO_MAX_POINTS]; // playouts ending with the point the winner's
+};
+
+void mc_ownership_init(struct mc_ownership *ownership, const struct go_state *state);
+
+// Adds a playout, given its final ownership as computed by go_score.
+void mc_ownership_add(struct mc_ownership *ownership, const go_color *owner, bool black_won);
+
+// Expected ownership of a point, from -1 (always white) to 1 (always black).
+double mc_ownership_value(const struct mc_ownership *ownership, go_move move);
+double mc_ownership_criticality(const struct mc_ownership *ownership, go_move move);
+
+// Expected raw score (black minus white, before komi).
+double mc_ownership_score(const struct mc_ownership *ownership);
+
+// Aggregate results of many playouts from one position.
+struct playout_result {
+    size_t num_playouts;
+    size_t num_black_wins; // with MC_KOMI
+    double mean_score;     // raw
+
+    // playouts by raw score, offset by MC_MAX_SCORE
+    uint32_t histogram[2 * MC_MAX_SCORE + 1];
+
+    struct mc_stats stats;
+};
+
+// Runs n uniform random playouts from state on the worker pool, in
+// batches of GO_BATCH_MAX lanes unless superko must be checked. Each
+// playout uses its own random stream, so results only depend on the seed
+// and the sequence of calls, not on the thread count. Not reentrant.
+bool mc_run_playouts(const struct go_state *state, size_t n, struct playout_result *result);
+
+// Runs playouts as mc_run_playouts does, also adding the final ownership of
+// each to ownership, which must have been initialized for state.
+bool mc_run_ownership(const struct go_state *state, size_t n, struct playout_result *result,
+                      struct mc_ownership *ownership);
+
+// Sets the number of pool threads, by default the number of processors.
+bool mc_set_threads(size_t num_threads);
+size_t mc_get_threads(void);
+
+struct mcts_store;
 
 struct mcts_tree {
-    struct go_state state;
+    uint64_t key;  // of the node's position, see the transposition table
+    go_color turn; // side to move in the node's position
     size_t num_playouts;
     size_t num_black_wins;
-    
-    struct mcts_tree *parent;
 
+    struct mcts_store *store; // node memory of the whole tree, owned by the root
+    struct mc_ownership *ownership; // NULL unless tracked for this node
+
+    // Per move statistics, kept in the parent as separate arrays so that
+    // selection scans a few contiguous arrays rather than every child.
+    // Wins are black's. The arrays share one block, allocated when the
+    // node's moves are generated after a few playouts; until then the node
+    // is a leaf with no moves. Ranked moves are sorted by prior and opened
+    // to selection progressively.
+    int phase;
+    bool ranked;
     size_t num_moves;
-    uint16_t moves[512];
-    struct mcts_tree *subtrees[];
+    uint32_t *visits;
+    uint32_t *black_wins;
+    uint32_t *pending; // playouts in progress through the move
+    uint32_t *amaf_visits;
+    uint32_t *amaf_black_wins;
+    float *priors; // from the playout policy at expansion, uniform without one
+    uint16_t *moves;
+    struct mcts_tree **subtrees;
 };
 
+// Nodes are allocated from an arena belonging to the tree and are all
+// released together. Positions reached by different move orders share one
+// node, found through a transposition table, so the tree is really a
+// directed graph and nodes have no parent pointer. Only the root's
+// position is stored; the others are replayed from it while searching.
+// Descending copies the nodes reachable from the chosen move, packed in
+// depth first order, into a new arena and drops the old one in bulk.
 struct mcts_tree *mcts_new(struct go_state *state);
 struct mcts_tree *mcts_descend(struct mcts_tree *tree, uint16_t move);
 void mcts_free(struct mcts_tree *tree);
 
-void mcts_run_random_playout(struct mcts_tree *tree);
-uint16_t mcts_choose(struct mcts_tree *tree);
+// number of nodes allocated for the tree
+size_t mcts_count_nodes(const struct mcts_tree *tree);
+
+// Starts accumulating the ownership of playouts through this node.
+bool mcts_track_ownership(struct mcts_tree *tree);
+const struct mc_ownership *mcts_ownership(const struct mcts_tree *tree);
+
+// Scratch space of one searching thread, set up once per search from the
+// root of a tree: the position being visited, which iterations reach from
+// the root's position with undoable moves and unwind when done, and its
+// undo log.
+struct mcts_walker {
+    struct go_state state;
+    struct go_undo undo;
+};
+
+bool mcts_walker_init(struct mcts_walker *walker, const struct mcts_tree *tree);
+void mcts_walker_free(struct mcts_walker *walker);
+
+// Runs one iteration of tree search from the root tree, with playouts drawn
+// from policy (NULL for uniform random playouts), using a walker set up for
+// tree. Any number of threads may run iterations on the same tree at once,
+// each with its own walker, but not alongside mcts_descend or mcts_free.
+void mcts_run_playout(struct mcts_tree *tree, const struct mc_policy *policy,
+                      struct rng *rng, struct mcts_walker *walker);
+
+// Runs n iterations on the worker pool (see mc_set_threads), each worker
+// with its own random stream. Like the other searches, it first generates
+// the root's moves if no search has yet, ranked by policy.
+bool mcts_run_playouts(struct mcts_tree *tree, const struct mc_policy *policy, size_t n);
+
+// Runs n iterations on the worker pool with root parallelism: every worker
+// searches a private tree from the same position and adds its root
+// statistics to this tree after each merge_interval iterations and when
+// done. Workers share nothing else, so only the merges
+// synchronize. Ownership maps are not updated.
+bool mcts_run_playouts_root(struct mcts_tree *tree, const struct mc_policy *policy,
+                            size_t n, size_t merge_interval);
+
+// Returns the move with the best pessimistic win rate for the side to move.
+uint16_t mcts_choose(struct mcts_tree *tree, struct rng *rng);
+
+// Limits of a search; zero means no limit, but at least one of seconds,
+// max_playouts and max_nodes must be set. A node limit may be the only
+// one: the search also stops once the tree no longer grows.
+struct search_limits {
+    double seconds;      // wall clock
+    size_t max_playouts; // run by this search
+    size_t max_nodes;    // allocated for the tree, see mcts_count_nodes
+
+    // stop as soon as the most visited move at the root can't be overtaken
+    // in the playouts left, estimated from the playout rate under a time
+    // limit
+    bool early_stop;
+
+    const struct mc_policy *policy; // NULL for uniform random playouts
+};
+
+// Searches on the worker pool (see mc_set_threads) until a limit is
+// reached, returning the number of playouts run. No search runs from a
+// finished game.
+size_t mcts_search(struct mcts_tree *tree, const struct search_limits *limits);
+
+// Seconds to spend on the next move out of the remaining main time, an
+// even share over the moves the side to move is expected to have left.
+double mcts_allot_time(double main_time, const struct go_state *state);
 
 #endif//KERPLUNK_MCTS_H_
@@ -0,0 +1,352 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "policy.h"
+#include "mcts.h"
+
+// position flags
+
+#define EMPTY GO_COLOR_EMPTY
+#define BLACK GO_COLOR_BLACK
+#define WHITE GO_COLOR_WHITE
+#define OFFBOARD GO_COLOR_OFFBOARD
+
+// built-in heuristic weights
+
+#define BASE_WEIGHT 100
+#define EDGE_WEIGHT 20 // first line move with nothing nearby
+#define ATARI_CAPTURE_WEIGHT 400 // per adjacent opposing string in atari
+#define ATARI_EXTEND_WEIGHT 200 // per adjacent own string in atari
+#define CAPTURE_BONUS 2000
+#define ESCAPE_BONUS 1000
+
+// the orthogonal neighbors (N, W, E, S) among the eight pattern points
+static const size_t _orthogonal[4] = {1, 3, 4, 6};
+
+go_pattern mc_pattern_swap(go_pattern pattern) {
+    // exchanging the two bits of every color field swaps BLACK and WHITE,
+    // and leaves EMPTY and OFFBOARD alone
+    const go_pattern colors = pattern & 0xFFFF;
+    const go_pattern swapped = ((colors & 0x5555) << 1) | ((colors >> 1) & 0x5555);
+    return (pattern & ~(go_pattern) 0xFFFF) | swapped;
+}
+
+static uint16_t _default_weight(go_pattern pattern) {
+    bool edge = false;
+    bool quiet = true;
+    uint32_t weight = BASE_WEIGHT;
+
+    for (size_t i = 0; i < 8; i++) {
+        const go_color color = GO_PATTERN_COLOR(pattern, i);
+        if (color == BLACK || color == WHITE) {
+            quiet = false;
+        }
+    }
+
+    for (size_t j = 0; j < 4; j++) {
+        const go_color color = GO_PATTERN_COLOR(pattern, _orthogonal[j]);
+
+        if (color == OFFBOARD) {
+            edge = true;
+        }
+
+        if (GO_PATTERN_ATARI(pattern, j)) {
+            if (color == WHITE) {
+                weight += ATARI_CAPTURE_WEIGHT;
+            }
+            else if (color == BLACK) {
+                weight += ATARI_EXTEND_WEIGHT;
+            }
+            else {
+                // atari bit on an empty point, never occurs
+                return 0;
+            }
+        }
+    }
+
+    if (edge && quiet) {
+        weight = EDGE_WEIGHT;
+    }
+
+    return weight;
+}
+
+struct mc_policy *mc_policy_new(void) {
+    struct mc_policy *policy = malloc(sizeof(struct mc_policy));
+    if (!policy) {
+        return NULL;
+    }
+
+    policy->capture_bonus = CAPTURE_BONUS;
+    policy->escape_bonus = ESCAPE_BONUS;
+    for (size_t i = 0; i < MC_POLICY_PATTERNS; i++) {
+        policy->weight[i] = _default_weight(i);
+    }
+
+    return policy;
+}
+
+void mc_policy_free(struct mc_policy *policy) {
+    free(policy);
+}
+
+//
+// weighted sampling
+//
+// Point weights for each color are kept in Fenwick trees, so changing one
+// weight and drawing a point with probability proportional to its weight
+// both take O(log n). Weights only change for points reported through the
+// state's change list, plus the temporary adjustments of each draw.
+//
+
+struct _sampler {
+    size_t num_points;
+    size_t top; // highest power of two <= num_points
+
+    uint32_t total[2];
+    uint32_t weight[2][GO_MAX_POINTS];
+    uint32_t tree[2][GO_MAX_POINTS + 1];
+};
+
+static void _adjust(struct _sampler *sampler, size_t side, go_point point, uint32_t weight) {
+    const uint32_t delta = weight - sampler->weight[side][point]; // modular
+    if (!delta) {
+        return;
+    }
+
+    sampler->weight[side][point] = weight;
+    sampler->total[side] += delta;
+    for (size_t i = point + 1; i <= sampler->num_points; i += i & -i) {
+        sampler->tree[side][i] += delta;
+    }
+}
+
+// Returns the point whose cumulative weight range contains target.
+static go_point _find(const struct _sampler *sampler, size_t side, uint32_t target) {
+    const uint32_t *tree = sampler->tree[side];
+
+    size_t pos = 0;
+    for (size_t step = sampler->top; step; step >>= 1) {
+        if (pos + step <= sampler->num_points && tree[pos + step] <= target) {
+            pos += step;
+            target -= tree[pos];
+        }
+    }
+
+    return pos;
+}
+
+static uint32_t _weight(const struct go_state *state, const struct mc_policy *policy,
+                        go_point point, go_color color) {
+
+    if (state->board[point] != EMPTY || !(state->legal[point] & color)) {
+        return 0;
+    }
+
+    if (go_is_eye(state, GO_POINT_MOVE(state, point), color)) {
+        return 0;
+    }
+
+    go_pattern pattern = GO_PATTERN_AT(state, point);
+    if (color == WHITE) {
+        pattern = mc_pattern_swap(pattern);
+    }
+
+    return policy->weight[pattern];
+}
+
+uint32_t mc_policy_weight(const struct mc_policy *policy, const struct go_state *state, go_move move) {
+    if (move == GO_MOVE_PASS) {
+        return 0;
+    }
+
+    return _weight(state, policy, GO_POINT(state, move), state->turn);
+}
+
+static void _update(struct _sampler *sampler, const struct go_state *state,
+                    const struct mc_policy *policy, go_point point) {
+
+    _adjust(sampler, 0, point, _weight(state, policy, point, BLACK));
+    _adjust(sampler, 1, point, _weight(state, policy, point, WHITE));
+}
+
+static void _sampler_init(struct _sampler *sampler, const struct go_state *state,
+                          const struct mc_policy *policy) {
+
+    memset(sampler, 0, sizeof(struct _sampler));
+    sampler->num_points = state->stride * state->stride;
+    sampler->top = 1;
+    while (sampler->top * 2 <= sampler->num_points) {
+        sampler->top *= 2;
+    }
+
+    for (size_t i = 0; i < state->num_empties; i++) {
+        _update(sampler, state, policy, state->empties[i]);
+    }
+}
+
+// Returns the only liberty of a string in atari.
+static go_point _liberty(const struct go_state *state, go_point head) {
+    const size_t stride = state->stride;
+
+    go_point stone = head;
+    do {
+        const go_point N[4] = {stone - stride, stone - 1, stone + 1, stone + stride};
+        for (size_t i = 0; i < 4; i++) {
+            if (state->board[N[i]] == EMPTY) {
+                return N[i];
+            }
+        }
+
+        stone = state->next[stone];
+    } while (stone != head);
+
+    assert(false);
+    return 0;
+}
+
+struct _adjustment {
+    go_point point;
+    uint32_t weight; // weight before the adjustment
+};
+
+static go_move _choose(struct _sampler *sampler, struct go_state *state,
+                       const struct mc_policy *policy, go_move last, struct rng *rng) {
+
+    const go_color own_color = state->turn;
+    const size_t side = own_color - 1;
+    const size_t stride = state->stride;
+
+    // temporary adjustments, undone in reverse order before returning
+    struct _adjustment adjusted[GO_MAX_POINTS + 8];
+    size_t num_adjusted = 0;
+
+    if (last != GO_MOVE_PASS) {
+
+        // strings in atari next to the last move: the last move's own
+        // string (capture it), and our strings it attacked (escape)
+        const go_point point = GO_POINT(state, last);
+        const go_point around[5] = {point, point - stride, point - 1, point + 1, point + stride};
+        go_point seen[5];
+        size_t num_seen = 0;
+
+        for (size_t i = 0; i < 5; i++) {
+            const go_color color = state->board[around[i]];
+            if (color != BLACK && color != WHITE) {
+                continue;
+            }
+
+            const go_point head = state->string[around[i]];
+            if (state->libs[head] != 1) {
+                continue;
+            }
+
+            uint32_t bonus;
+            if (i == 0 && color != own_color) {
+                bonus = policy->capture_bonus;
+            }
+            else if (i > 0 && color == own_color) {
+                bonus = policy->escape_bonus;
+            }
+            else {
+                continue;
+            }
+
+            bool duplicate = false;
+            for (size_t j = 0; j < num_seen; j++) {
+                if (seen[j] == head) {
+                    duplicate = true;
+                }
+            }
+            if (duplicate) {
+                continue;
+            }
+            seen[num_seen] = head;
+            num_seen++;
+
+            const go_point liberty = _liberty(state, head);
+            const uint32_t weight = sampler->weight[side][liberty];
+            if (weight) {
+                adjusted[num_adjusted].point = liberty;
+                adjusted[num_adjusted].weight = weight;
+                num_adjusted++;
+                _adjust(sampler, side, liberty, weight + bonus);
+            }
+        }
+    }
+
+    // draw until the point also passes the ko and superko checks
+    go_move move = GO_MOVE_PASS;
+    while (sampler->total[side]) {
+        const go_point point = _find(sampler, side, rng_bounded(rng, sampler->total[side]));
+        if (go_legal(state, GO_POINT_MOVE(state, point))) {
+            move = GO_POINT_MOVE(state, point);
+            break;
+        }
+
+        adjusted[num_adjusted].point = point;
+        adjusted[num_adjusted].weight = sampler->weight[side][point];
+        num_adjusted++;
+        _adjust(sampler, side, point, 0);
+    }
+
+    while (num_adjusted) {
+        num_adjusted--;
+        _adjust(sampler, side, adjusted[num_adjusted].point, adjusted[num_adjusted].weight);
+    }
+
+    return move;
+}
+
+int16_t mc_run_heavy_playout(struct go_state *state, const struct mc_policy *policy,
+                             struct rng *rng, struct mc_amaf *amaf, struct mc_stats *stats) {
+
+    struct _sampler sampler;
+    _sampler_init(&sampler, state, policy);
+
+    struct go_changes changes;
+    changes.count = 0;
+    changes.overflow = false;
+    struct go_changes *const saved_changes = state->changes;
+    state->changes = &changes;
+
+    const size_t max_moves = MC_MAX_MOVES(state->size);
+    size_t num_moves = 0;
+    go_move last = GO_MOVE_PASS;
+    while (!state->scored && num_moves < max_moves) {
+        last = _choose(&sampler, state, policy, last, rng);
+        mc_amaf_play(amaf, state, last);
+        go_play(state, last);
+        num_moves++;
+
+        if (changes.overflow) {
+            _sampler_init(&sampler, state, policy);
+        }
+        else {
+            for (size_t i = 0; i < changes.count; i++) {
+                _update(&sampler, state, policy, changes.points[i]);
+            }
+        }
+
+        changes.count = 0;
+        changes.overflow = false;
+    }
+
+    state->changes = saved_changes;
+
+    if (stats) {
+        stats->num_playouts++;
+        stats->num_moves += num_moves;
+        if (!state->scored) {
+            stats->num_capped++;
+        }
+    }
+
+    if (!state->scored) {
+        return go_score(state, NULL);
+    }
+
+    return state->score;
+}
@@ -0,0 +1,48 @@
+#ifndef KERPLUNK_POLICY_H_
+#define KERPLUNK_POLICY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "go.h"
+#include "rng.h"
+
+//
+// heavy playout policy
+//
+// Playout moves are drawn with probability proportional to a weight looked
+// up by the 3x3 pattern code of the point, seen from the side to move
+// (black's perspective; white's codes have their colors swapped first).
+// Capturing the last move's string or saving a string put in atari by the
+// last move earns an extra bonus for that one move. Eyes of the side to
+// move and illegal points always have weight zero.
+//
+
+#define MC_POLICY_PATTERNS ((size_t) 1 << GO_PATTERN_BITS)
+
+struct mc_policy {
+    uint32_t capture_bonus;
+    uint32_t escape_bonus;
+
+    uint16_t weight[MC_POLICY_PATTERNS];
+};
+
+// Allocates a policy with the built-in heuristic weights.
+struct mc_policy *mc_policy_new(void);
+void mc_policy_free(struct mc_policy *policy);
+
+// Weight of a move for the side to move, 0 for passes.
+uint32_t mc_policy_weight(const struct mc_policy *policy, const struct go_state *state, go_move move);
+
+// Swaps black and white in a pattern code.
+go_pattern mc_pattern_swap(go_pattern pattern);
+
+struct mc_amaf;
+struct mc_stats;
+
+// Like mc_run_random_playout, drawing moves from the policy.
+int16_t mc_run_heavy_playout(struct go_state *state, const struct mc_policy *policy,
+                             struct rng *rng, struct mc_amaf *amaf, struct mc_stats *stats);
+
+#endif//KERPLUNK_POLICY_H_
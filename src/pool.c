@@ -0,0 +1,153 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+struct _worker {
+    struct pool *pool;
+    size_t index;
+    pthread_t thread;
+};
+
+struct pool {
+    size_t num_threads;
+    struct _worker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start; // a job was posted, or the pool is shutting down
+    pthread_cond_t done;  // the last worker finished the job
+
+    // current job, guarded by lock
+    void (*fn)(void *arg, size_t worker);
+    void *arg;
+    size_t generation; // incremented for every job
+    size_t num_running;
+    bool quit;
+};
+
+static void *_worker_main(void *arg) {
+    struct _worker *worker = arg;
+    struct pool *pool = worker->pool;
+    size_t generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->quit && pool->generation == generation) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+
+        if (pool->quit) {
+            break;
+        }
+
+        generation = pool->generation;
+        void (*fn)(void *, size_t) = pool->fn;
+        void *fn_arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        fn(fn_arg, worker->index);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->num_running--;
+        if (pool->num_running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void _shutdown(struct pool *pool, size_t num_started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < num_started; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+struct pool *pool_new(size_t num_threads) {
+    assert(num_threads > 0);
+
+    struct pool *pool = malloc(sizeof(struct pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->num_threads = num_threads;
+    pool->workers = malloc(num_threads * sizeof(struct _worker));
+    pool->fn = NULL;
+    pool->arg = NULL;
+    pool->generation = 0;
+    pool->num_running = 0;
+    pool->quit = false;
+
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (size_t i = 0; i < num_threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+
+        if (pthread_create(&pool->workers[i].thread, NULL, _worker_main, &pool->workers[i])) {
+            // thread creation error
+            _shutdown(pool, i);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void pool_free(struct pool *pool) {
+    if (!pool) {
+        return;
+    }
+
+    _shutdown(pool, pool->num_threads);
+}
+
+size_t pool_size(const struct pool *pool) {
+    return pool->num_threads;
+}
+
+void pool_run(struct pool *pool, void (*fn)(void *arg, size_t worker), void *arg) {
+    pthread_mutex_lock(&pool->lock);
+    assert(pool->num_running == 0);
+
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->num_running = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+
+    while (pool->num_running) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t pool_default_size(void) {
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (size_t) count : 1;
+}
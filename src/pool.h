@@ -0,0 +1,30 @@
+#ifndef KERPLUNK_POOL_H_
+#define KERPLUNK_POOL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// persistent worker thread pool
+//
+// The threads are started once and sleep between jobs. A job is a function
+// run once on every worker, which is told its index; workers split the
+// work among themselves (e.g. through an atomic counter).
+//
+
+struct pool;
+
+struct pool *pool_new(size_t num_threads);
+void pool_free(struct pool *pool);
+
+size_t pool_size(const struct pool *pool);
+
+// Runs fn(arg, worker) on every worker and waits until all have returned.
+// Only one job may run at a time.
+void pool_run(struct pool *pool, void (*fn)(void *arg, size_t worker), void *arg);
+
+// number of online processors, at least 1
+size_t pool_default_size(void);
+
+#endif//KERPLUNK_POOL_H_
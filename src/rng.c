@@ -0,0 +1,42 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rng.h"
+
+static uint64_t _seed = 1;
+
+static inline uint64_t _splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void rng_set_seed(uint64_t seed) {
+    _seed = seed;
+}
+
+uint64_t rng_get_seed(void) {
+    return _seed;
+}
+
+void rng_init(struct rng *rng, uint64_t stream) {
+    rng_init_seed(rng, _seed, stream);
+}
+
+void rng_init_seed(struct rng *rng, uint64_t seed, uint64_t stream) {
+
+    // mix the stream into the seed first, so nearby seeds and streams
+    // give unrelated states
+    uint64_t x = seed;
+    x = _splitmix64(&x) ^ stream;
+
+    for (size_t i = 0; i < 4; i++) {
+        rng->s[i] = _splitmix64(&x);
+    }
+
+    // the all-zero state is a fixed point
+    if (!(rng->s[0] | rng->s[1] | rng->s[2] | rng->s[3])) {
+        rng->s[0] = 1;
+    }
+}
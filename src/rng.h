@@ -0,0 +1,71 @@
+#ifndef KERPLUNK_RNG_H_
+#define KERPLUNK_RNG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// pseudorandom number generation
+//
+// xoshiro256** generators, one per thread (or per playout lane); they are
+// not safe to share. Every generator is derived from a process-wide seed
+// (set from the command line, or from the clock by default) and a stream
+// number, so runs with the same seed are reproducible.
+//
+
+struct rng {
+    uint64_t s[4];
+};
+
+void rng_set_seed(uint64_t seed);
+uint64_t rng_get_seed(void);
+
+// Seeds a generator for the given stream of the process-wide seed.
+void rng_init(struct rng *rng, uint64_t stream);
+
+// Seeds a generator for the given stream of an explicit seed.
+void rng_init_seed(struct rng *rng, uint64_t seed, uint64_t stream);
+
+static inline uint64_t _rng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(struct rng *rng) {
+    uint64_t *s = rng->s;
+    const uint64_t result = _rng_rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = _rng_rotl(s[3], 45);
+
+    return result;
+}
+
+// Uniform integer in [0, bound), bound > 0, without modulo bias (Lemire's
+// multiply-and-reject method; the division only runs on a rejection path
+// that is rarely taken).
+static inline uint32_t rng_bounded(struct rng *rng, uint32_t bound) {
+    uint64_t m = (rng_next(rng) >> 32) * (uint64_t) bound;
+    uint32_t low = (uint32_t) m;
+
+    if (low < bound) {
+        const uint32_t threshold = -bound % bound;
+        while (low < threshold) {
+            m = (rng_next(rng) >> 32) * (uint64_t) bound;
+            low = (uint32_t) m;
+        }
+    }
+
+    return m >> 32;
+}
+
+// Uniform double in [0, 1).
+static inline double rng_double(struct rng *rng) {
+    return (rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif//KERPLUNK_RNG_H_